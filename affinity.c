@@ -0,0 +1,31 @@
+/************************************************************
+	affinity.c
+	Pin a thread to one cpu
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+This needs _GNU_SOURCE, which makes netdb.h declare a gai_error that
+conflicts with the one in csapp.h, so it lives in its own file.
+
+************************************************************/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "affinity.h"
+
+/*
+	pin_to_cpu: run the calling thread only on cpu
+	(modulo the number of online cpus).
+	return 0 when success, an error number otherwise
+*/
+int pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    long ncpus=sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(ncpus<1)
+        ncpus=1;
+    CPU_ZERO(&set);
+    CPU_SET(cpu%ncpus,&set);
+    return pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+}
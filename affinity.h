@@ -0,0 +1,14 @@
+/************************************************************
+	affinity.h
+	Pin a thread to one cpu
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+int pin_to_cpu(int cpu);
+
+#endif /* __AFFINITY_H__ */
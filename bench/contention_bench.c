@@ -0,0 +1,119 @@
+/************************************************************
+	contention_bench.c
+	Cache throughput with many threads on the same hot urls
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+From 1 to 64 threads look up a small set of hot urls in the sharded
+cache, as the proxy's hits do (lookup_shard, then release the block),
+and one request in INSERT_EVERY replaces its url's block, as a miss
+would. Each point runs for the given time; the lookups per second are
+printed for every shard count asked for, so one shard (one lock for
+the whole cache, as before the shards) can be compared with several.
+The speedup only shows on a machine with that many cores.
+
+usage: bench/contention_bench [milliseconds [shards...]]
+       (default 300 ms, 1 and 8 shards)
+
+************************************************************/
+#include <time.h>
+#include "cache.h"
+
+#define HOT_URLS 64
+#define OBJECT_SIZE 1024
+#define INSERT_EVERY 100
+#define MAX_THREADS 64
+
+static Sharded_cache_t cache;
+static char* hot[HOT_URLS];
+static char body[OBJECT_SIZE];
+static volatile int running;
+
+static void* hammer(void* vargp);
+static long now_ns(void);
+
+
+int main(int argc, char** argv) {
+    long ms=argc>1? atol(argv[1]) : 300;
+    int shards[8]={1,8},nshards=2;
+    long counts[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    char url[MAXLINE];
+    int i,s,nthreads;
+
+    if(argc>2) {
+        for(nshards=0;nshards<8&&nshards+2<argc;nshards++)
+            shards[nshards]=atoi(argv[nshards+2]);
+    }
+    for(i=0;i<HOT_URLS;i++) {
+        sprintf(url,"http://origin.example/hot/%d",i);
+        hot[i]=strdup(url);
+    }
+    printf("%8s","threads");
+    for(s=0;s<nshards;s++)
+        printf("  %10s%-3d","lookups/s@",shards[s]);
+    printf("\n");
+
+    for(nthreads=1;nthreads<=MAX_THREADS;nthreads*=2) {
+        printf("%8d",nthreads);
+        for(s=0;s<nshards;s++) {
+            long total=0,start;
+
+            init_sharded_cache(&cache,shards[s],HOT_URLS*OBJECT_SIZE*4,
+                CACHE_LRU);
+            for(i=0;i<HOT_URLS;i++)
+                insert_to_shard(construct_cache_block(hot[i],body,
+                    OBJECT_SIZE),select_shard(cache_hash(hot[i]),&cache));
+            running=1;
+            start=now_ns();
+            for(i=0;i<nthreads;i++)
+                Pthread_create(&tids[i],NULL,hammer,&counts[i]);
+            usleep(ms*1000);
+            running=0;
+            for(i=0;i<nthreads;i++) {
+                Pthread_join(tids[i],NULL);
+                total+=counts[i];
+            }
+            printf("  %13ld",total*1000000000L/(now_ns()-start));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+/*
+	hammer: look up hot urls until running is cleared, every
+	INSERT_EVERY-th one is inserted again; *vargp gets the count
+*/
+static void* hammer(void* vargp) {
+    unsigned long seed=(unsigned long)vargp;
+    long n=0;
+
+    while(running) {
+        seed=seed*6364136223846793005UL+1442695040888963407UL;
+        char* url=hot[(seed>>33)%HOT_URLS];
+        unsigned long hash=cache_hash(url);
+        Cache_shard_t* shard=select_shard(hash,&cache);
+        if(n%INSERT_EVERY==INSERT_EVERY-1)
+            insert_to_shard(construct_cache_block(url,body,OBJECT_SIZE),
+                shard);
+        else {
+            Cache_t* block=lookup_shard(url,hash,shard);
+            if(block)
+                release_cache_block(block);
+        }
+        n++;
+    }
+    *(long*)vargp=n;
+    return NULL;
+}
+
+/*
+	now_ns: monotonic time in nanoseconds
+*/
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000000L+ts.tv_nsec;
+}
@@ -0,0 +1,143 @@
+/************************************************************
+	loadgen.c
+	A load generator for the benchmarks
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+Threads ask the proxy for the given urls, picked at random, one
+request per connection (HTTP/1.0, which every server mode of the
+proxy answers the same way), for the given number of seconds. Prints
+the requests per second and the latency of a whole request, from the
+connect to the last byte, at the 50th, 99th and 99.9th percentile and
+the largest one.
+
+usage: bench/loadgen <proxy port> <threads> <seconds> <url>...
+
+************************************************************/
+#include <time.h>
+#include "csapp.h"
+
+/* latencies kept per thread, later ones are not recorded */
+#define MAX_SAMPLES 1000000
+
+struct loader {
+    pthread_t tid;
+    unsigned long seed;
+    long* samples; // latencies in microseconds
+    long count;
+    long failed;
+};
+
+static char* proxy_port;
+static char** urls;
+static int nurls;
+static volatile int running;
+
+static void* load_thread(void* vargp);
+static long fetch(char* url);
+static long now_us(void);
+static int compare_long(const void* a, const void* b);
+
+
+int main(int argc, char** argv) {
+    struct loader* loaders;
+    long* all;
+    long total=0,failed=0,seconds,i,j;
+    int nthreads;
+
+    if(argc<5) {
+        fprintf(stderr,"usage: %s <proxy port> <threads> <seconds>"
+            " <url>...\n",argv[0]);
+        exit(1);
+    }
+    Signal(SIGPIPE, SIG_IGN);
+    proxy_port=argv[1];
+    nthreads=atoi(argv[2]);
+    seconds=atol(argv[3]);
+    urls=argv+4;
+    nurls=argc-4;
+
+    loaders=Calloc(nthreads,sizeof(struct loader));
+    running=1;
+    for(i=0;i<nthreads;i++) {
+        loaders[i].seed=i+1;
+        loaders[i].samples=Malloc(MAX_SAMPLES*sizeof(long));
+        Pthread_create(&loaders[i].tid,NULL,load_thread,&loaders[i]);
+    }
+    sleep(seconds);
+    running=0;
+    for(i=0;i<nthreads;i++) {
+        Pthread_join(loaders[i].tid,NULL);
+        total+=loaders[i].count;
+        failed+=loaders[i].failed;
+    }
+
+    all=Malloc((total? total : 1)*sizeof(long));
+    for(i=0,j=0;i<nthreads;i++) {
+        memcpy(all+j,loaders[i].samples,loaders[i].count*sizeof(long));
+        j+=loaders[i].count;
+    }
+    qsort(all,total,sizeof(long),compare_long);
+    printf("requests/s=%ld failed=%ld",total/seconds,failed);
+    if(total>0)
+        printf(" p50_us=%ld p99_us=%ld p999_us=%ld max_us=%ld",
+            all[total/2],all[total*99/100],all[total*999/1000],
+            all[total-1]);
+    printf("\n");
+    return 0;
+}
+
+/*
+	load_thread: fetch random urls until running is cleared
+*/
+static void* load_thread(void* vargp) {
+    struct loader* l=vargp;
+    long us;
+
+    while(running) {
+        l->seed=l->seed*6364136223846793005UL+1442695040888963407UL;
+        if((us=fetch(urls[(l->seed>>33)%nurls]))<0)
+            l->failed++;
+        else if(l->count<MAX_SAMPLES)
+            l->samples[l->count++]=us;
+    }
+    return NULL;
+}
+
+/*
+	fetch: ask the proxy for url and read the whole response
+	return how long it took in microseconds, -1 when it failed
+*/
+static long fetch(char* url) {
+    char buf[MAXBUF];
+    long start=now_us(),n,total=0;
+    int fd;
+
+    if((fd=open_clientfd("127.0.0.1",proxy_port))<0)
+        return -1;
+    n=snprintf(buf,sizeof(buf),"GET %s HTTP/1.0\r\n\r\n",url);
+    if(rio_writen(fd,buf,n)<0) {
+        Close(fd);
+        return -1;
+    }
+    while((n=read(fd,buf,sizeof(buf)))>0)
+        total+=n;
+    Close(fd);
+    if(n<0||total==0)
+        return -1;
+    return now_us()-start;
+}
+
+/*
+	now_us: monotonic time in microseconds
+*/
+static long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000L+ts.tv_nsec/1000;
+}
+
+static int compare_long(const void* a, const void* b) {
+    long x=*(const long*)a,y=*(const long*)b;
+    return x<y? -1 : x>y;
+}
@@ -0,0 +1,111 @@
+/************************************************************
+	lookup_bench.c
+	Lookup latency of the cache's hash index
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+Fills one cache table with 100, 10k and 1M small blocks and times
+find_in_cache on urls that are cached (hits) and urls that are not
+(misses), in nanoseconds per lookup. For comparison it also times a
+walk of the whole LRU list comparing every url, which is what a
+lookup cost before the index; that walk is only timed up to 10k
+blocks, at 1M it takes seconds per lookup.
+
+usage: bench/lookup_bench [lookups]   (default 1000000)
+
+************************************************************/
+#include <time.h>
+#include "cache.h"
+
+#define MISS_URLS 4096
+
+static long now_ns(void);
+static Cache_t* list_walk(char* url, Cache_table_t* cache);
+
+
+int main(int argc, char** argv) {
+    long sizes[]={100,10000,1000000};
+    long lookups=argc>1? atol(argv[1]) : 1000000;
+    char url[MAXLINE];
+    static char* misses[MISS_URLS];
+    unsigned long seed=1;
+    int s,i;
+
+    for(i=0;i<MISS_URLS;i++) {
+        sprintf(url,"http://origin.example/missing/%d",i);
+        misses[i]=strdup(url);
+    }
+    printf("%10s %12s %12s %12s\n","entries","hit_ns","miss_ns","walk_ns");
+    for(s=0;s<3;s++) {
+        Cache_table_t table;
+        Cache_t** blocks=Malloc(sizes[s]*sizeof(Cache_t*));
+        long n,found=0,start,hit_ns,miss_ns,walk_ns=-1;
+
+        init_cache(&table,CACHE_LRU,0);
+        for(n=0;n<sizes[s];n++) {
+            sprintf(url,"http://origin.example/object/%ld",n);
+            blocks[n]=new_cache_block(url,0);
+            add_to_cache(blocks[n],&table);
+        }
+
+        start=now_ns();
+        for(n=0;n<lookups;n++) {
+            seed=seed*6364136223846793005UL+1442695040888963407UL;
+            Cache_t* b=blocks[(seed>>33)%sizes[s]];
+            found+=find_in_cache(b->url,b->hash,&table)!=NULL;
+        }
+        hit_ns=(now_ns()-start)/lookups;
+
+        start=now_ns();
+        for(n=0;n<lookups;n++) {
+            char* u=misses[n%MISS_URLS];
+            found+=find_in_cache(u,cache_hash(u),&table)!=NULL;
+        }
+        // the hash of a miss is computed in the loop, as a request does
+        miss_ns=(now_ns()-start)/lookups;
+
+        if(sizes[s]<=10000) {
+            long walks=lookups/sizes[s]+1;
+            start=now_ns();
+            for(n=0;n<walks;n++) {
+                seed=seed*6364136223846793005UL+1442695040888963407UL;
+                found+=list_walk(blocks[(seed>>33)%sizes[s]]->url,
+                    &table)!=NULL;
+            }
+            walk_ns=(now_ns()-start)/walks;
+        }
+        if(found!=lookups+(walk_ns<0? 0 : lookups/sizes[s]+1)) {
+            fprintf(stderr,"lookup error: %ld found\n",found);
+            exit(1);
+        }
+
+        printf("%10ld %12ld %12ld ",sizes[s],hit_ns,miss_ns);
+        if(walk_ns<0)
+            printf("%12s\n","-");
+        else
+            printf("%12ld\n",walk_ns);
+        // the blocks are left to the exit, free_cache prints as it goes
+    }
+    return 0;
+}
+
+/*
+	now_ns: monotonic time in nanoseconds
+*/
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000000L+ts.tv_nsec;
+}
+
+/*
+	list_walk: find url by comparing it with every block's url, the
+	way find_in_cache did before the index
+*/
+static Cache_t* list_walk(char* url, Cache_table_t* cache) {
+    Cache_t* p;
+    for(p=cache->lists[CACHE_PROBATION].head;p;p=p->next)
+        if(!strcmp(url,p->url))
+            return p;
+    return NULL;
+}
@@ -0,0 +1,99 @@
+/************************************************************
+	origin.c
+	A stand-in origin server for the benchmarks
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+Answers GET /<size>/<anything> with a body of size bytes, so the
+benchmarks can ask for as many distinct objects of any size as they
+need without a real server. The body is random bytes, or lines of
+TEXT_LINE characters when the size is preceded by text/, as in
+/text/<size>/<anything>. Responses are HTTP/1.1 with a
+Content-Length and may be cached for an hour, unless the path starts
+with /nocache/, then they say Cache-Control: no-store. Connections
+are persistent unless the request says Connection: close, each one is
+served by a thread of its own.
+
+usage: bench/origin <port>
+
+************************************************************/
+#include <stdbool.h>
+#include "csapp.h"
+
+/* a response body is at most this large */
+#define ORIGIN_MAX_BODY (64*1024*1024)
+/* characters in a line of a text body, with its newline */
+#define TEXT_LINE 64
+
+static char* body; // random bytes
+static char* text; // lines of text
+
+static void* serve_conn(void* vargp);
+
+
+int main(int argc, char** argv) {
+    long fd,i;
+    unsigned long x=1;
+    int listenfd;
+    pthread_t tid;
+
+    if(argc!=2) {
+        fprintf(stderr,"usage: %s <port>\n",argv[0]);
+        exit(1);
+    }
+    Signal(SIGPIPE, SIG_IGN);
+    body=Malloc(ORIGIN_MAX_BODY);
+    text=Malloc(ORIGIN_MAX_BODY);
+    for(i=0;i<ORIGIN_MAX_BODY;i++) {
+        x=x*6364136223846793005UL+1442695040888963407UL;
+        body[i]=x>>56;
+        text[i]=i%TEXT_LINE==TEXT_LINE-1? '\n' : 'a'+i%26;
+    }
+    listenfd=Open_listenfd(argv[1]);
+    while(1) {
+        fd=Accept(listenfd,NULL,NULL);
+        Pthread_create(&tid,NULL,serve_conn,(void*)fd);
+    }
+    return 0;
+}
+
+/*
+	serve_conn: answer the requests of one connection until the
+	client closes it or asks for it to be closed
+*/
+static void* serve_conn(void* vargp) {
+    char line[MAXLINE],head[MAXLINE],path[MAXLINE];
+    char *p,*data;
+    int fd=(long)vargp;
+    bool close_after=false,no_store;
+    long size;
+    rio_t rio;
+
+    Pthread_detach(pthread_self());
+    Rio_readinitb(&rio,fd);
+    while(!close_after&&rio_readlineb(&rio,line,MAXLINE)>0) {
+        if(sscanf(line,"GET %s",path)!=1)
+            break;
+        while(rio_readlineb(&rio,head,MAXLINE)>0&&strcmp(head,"\r\n"))
+            if(!strcasecmp(head,"Connection: close\r\n"))
+                close_after=true;
+        p=path+1;
+        if((no_store=!strncmp(p,"nocache/",8)))
+            p+=8;
+        data=body;
+        if(!strncmp(p,"text/",5)) {
+            data=text;
+            p+=5;
+        }
+        size=atol(p);
+        if(size<0||size>ORIGIN_MAX_BODY)
+            size=0;
+        sprintf(head,"HTTP/1.1 200 OK\r\nContent-Length: %ld\r\n"
+            "Cache-Control: %s\r\n\r\n",size,
+            no_store? "no-store" : "max-age=3600");
+        if(rio_writen(fd,head,strlen(head))<0||rio_writen(fd,data,size)<0)
+            break;
+    }
+    Close(fd);
+    return NULL;
+}
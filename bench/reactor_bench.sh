@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# reactor_bench.sh: requests per second against the number of
+# reactors (-r), with the thread per connection server for comparison.
+# 64 small objects are cached first, then bench/loadgen asks for them
+# from 32 threads, one request per connection, against bench/origin.
+#
+# usage: bench/reactor_bench.sh [seconds]   (default 3), from the
+# top directory after make and make bench
+#
+SECONDS_PER_POINT=${1:-3}
+ORIGIN_PORT=19080
+PROXY_PORT=19081
+
+bench/origin $ORIGIN_PORT &
+origin=$!
+urls=""
+for i in $(seq 1 64); do
+    urls="$urls http://127.0.0.1:$ORIGIN_PORT/512/$i"
+done
+
+for mode in "" "-r 1" "-r 2" "-r 4" "-r 8"; do
+    ./proxy $mode $PROXY_PORT >/dev/null 2>&1 &
+    proxy=$!
+    sleep 0.5
+    bench/loadgen $PROXY_PORT 4 1 $urls >/dev/null # fill the cache
+    printf "%-10s " "${mode:-threads}"
+    bench/loadgen $PROXY_PORT 32 $SECONDS_PER_POINT $urls
+    kill $proxy
+    wait $proxy 2>/dev/null
+done
+kill $origin
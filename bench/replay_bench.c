@@ -0,0 +1,125 @@
+/************************************************************
+	replay_bench.c
+	Hit ratios of the cache policies on a synthetic trace
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+Replays one trace against a sharded cache of the proxy's size with
+each policy of -E (lru, slru, tinylfu) and prints the hit ratio and
+byte hit ratio of each. The trace mixes requests for REPLAY_HOT_URLS
+urls whose popularity follows a Zipf law with the given skew, and a
+scan: the given fraction of requests are for urls that are never
+asked for again, like a crawler's. Halfway through, the popular urls
+change, so a policy also has to forget. Objects are 1 KB to 21 KB,
+picked by the url's hash. A miss inserts the object, as the proxy
+does once it is fetched.
+
+The trace is made from a fixed seed, so every policy sees the same
+requests and runs are repeatable.
+
+usage: bench/replay_bench [scan [skew [requests]]]   (default 0.3,
+0.8 and 400000)
+
+************************************************************/
+#include <math.h>
+#include "proxy.h"
+
+#define REPLAY_HOT_URLS 5000
+#define REPLAY_SHARDS 8 // as the proxy by default
+#define REPLAY_MIN_SIZE 1000
+#define REPLAY_SIZE_RANGE 20000
+
+static double uniform(unsigned long* seed);
+static int zipf_pick(double* cdf, double u);
+
+
+int main(int argc, char** argv) {
+    const char* names[]={"lru","slru","tinylfu"};
+    Cache_policy_t policies[]={CACHE_LRU,CACHE_SLRU,CACHE_TINYLFU};
+    double scan=argc>1? atof(argv[1]) : 0.3;
+    double skew=argc>2? atof(argv[2]) : 0.8;
+    long requests=argc>3? atol(argv[3]) : 400000;
+    static double cdf[REPLAY_HOT_URLS];
+    char url[MAXLINE];
+    double sum=0;
+    int p,i;
+
+    // cdf[i]: the chance that a hot request is for one of urls 0..i
+    for(i=0;i<REPLAY_HOT_URLS;i++) {
+        sum+=1/pow(i+1,skew);
+        cdf[i]=sum;
+    }
+    for(i=0;i<REPLAY_HOT_URLS;i++)
+        cdf[i]/=sum;
+
+    printf("scan=%.2f skew=%.2f requests=%ld\n",scan,skew,requests);
+    printf("%-8s %8s %14s %10s\n","policy","hit%","byte_hit%","rejected");
+    for(p=0;p<3;p++) {
+        Sharded_cache_t cache;
+        unsigned long seed=42,hash;
+        long r,hits=0,hit_bytes=0,bytes=0,scanned=0,rejected=0;
+        int id;
+        size_t size;
+
+        init_sharded_cache(&cache,REPLAY_SHARDS,MAX_CACHE_SIZE,
+            policies[p]);
+        for(r=0;r<requests;r++) {
+            if(uniform(&seed)<scan)
+                sprintf(url,"http://scan.example/%ld",scanned++);
+            else {
+                id=zipf_pick(cdf,uniform(&seed));
+                if(r>=requests/2) // other urls are popular now
+                    id=(id+REPLAY_HOT_URLS/2)%REPLAY_HOT_URLS;
+                sprintf(url,"http://hot.example/%d",id);
+            }
+            hash=cache_hash(url);
+            size=REPLAY_MIN_SIZE+(hash>>40)%REPLAY_SIZE_RANGE;
+            bytes+=size;
+
+            Cache_shard_t* shard=select_shard(hash,&cache);
+            Cache_t* block=lookup_shard(url,hash,shard);
+            if(block) {
+                hits++;
+                hit_bytes+=block->response_size;
+                release_cache_block(block);
+                continue;
+            }
+            if((block=new_cache_block(url,size))==NULL)
+                continue; // the slab arena is full, it is not cached
+            block->response_size=size;
+            insert_to_shard(block,shard);
+        }
+        for(i=0;i<cache.nshards;i++)
+            rejected+=cache.shards[i].rejected;
+        printf("%-8s %8.1f %14.1f %10ld\n",names[p],hits*100.0/requests,
+            hit_bytes*100.0/bytes,rejected);
+        fflush(stdout);
+        // the cache is left to the exit, free_cache reports on stdout
+    }
+    return 0;
+}
+
+
+/*
+	uniform: the next number of the generator, in [0,1)
+*/
+static double uniform(unsigned long* seed) {
+    *seed=*seed*6364136223846793005UL+1442695040888963407UL;
+    return (*seed>>11)*(1.0/9007199254740992.0);
+}
+
+/*
+	zipf_pick: the hot url u falls on, the first whose cdf is >= u
+*/
+static int zipf_pick(double* cdf, double u) {
+    int lo=0,hi=REPLAY_HOT_URLS-1,mid;
+
+    while(lo<hi) {
+        mid=(lo+hi)/2;
+        if(cdf[mid]>=u)
+            hi=mid;
+        else
+            lo=mid+1;
+    }
+    return lo;
+}
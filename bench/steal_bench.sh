@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# steal_bench.sh: tail latency of cache hits while large uncached
+# downloads take up the workers, with the shared FIFO queue (-p) and
+# with the work-stealing deques (-w), both with the same number of
+# workers. 8 threads of bench/loadgen download 4 MB objects that are
+# not cached while 8 others ask for 64 cached 512 byte objects; the
+# latency printed is the one of the small objects.
+#
+# usage: bench/steal_bench.sh [workers [seconds]]   (default 4 and 5),
+# from the top directory after make and make bench
+#
+WORKERS=${1:-4}
+SECONDS_PER_POINT=${2:-5}
+ORIGIN_PORT=19080
+PROXY_PORT=19081
+
+bench/origin $ORIGIN_PORT &
+origin=$!
+small=""
+large=""
+for i in $(seq 1 64); do
+    small="$small http://127.0.0.1:$ORIGIN_PORT/512/$i"
+done
+for i in $(seq 1 8); do
+    large="$large http://127.0.0.1:$ORIGIN_PORT/nocache/4194304/$i"
+done
+
+for mode in "-p $WORKERS" "-w $WORKERS"; do
+    ./proxy $mode $PROXY_PORT >/dev/null 2>&1 &
+    proxy=$!
+    sleep 0.5
+    bench/loadgen $PROXY_PORT 4 1 $small >/dev/null # fill the cache
+    bench/loadgen $PROXY_PORT 8 $SECONDS_PER_POINT $large >/dev/null &
+    downloads=$!
+    printf "%-6s small: " "$mode"
+    bench/loadgen $PROXY_PORT 8 $SECONDS_PER_POINT $small
+    wait $downloads
+    kill $proxy
+    wait $proxy 2>/dev/null
+done
+kill $origin
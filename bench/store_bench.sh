@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# store_bench.sh: how long the proxy takes to start with a full store
+# (-c). A store of the given size is filled with 100 KB objects from
+# bench/origin, then the proxy is started on it again several times.
+# Each run prints the time init_store took by the proxy's own clock
+# (the "started in" line) and the time from starting the proxy to the
+# first answer for a stored object, with the origin gone. The file
+# stays in the page cache between runs.
+#
+# usage: bench/store_bench.sh [megabytes [runs]]   (default 1024 and
+# 5), from the top directory after make and make bench; needs curl
+# and that many megabytes free in /tmp
+#
+STORE_MB=${1:-1024}
+RUNS=${2:-5}
+SIZE=100000
+ORIGIN_PORT=19080
+PROXY_PORT=19081
+STORE=/tmp/store_bench.$$
+OUT=/tmp/store_bench.out.$$
+# a few more objects than fit, so the ring goes round once
+OBJECTS=$((STORE_MB*1048576/SIZE*11/10))
+
+bench/origin $ORIGIN_PORT &
+origin=$!
+./proxy -c $STORE -C $STORE_MB $PROXY_PORT >/dev/null 2>&1 &
+proxy=$!
+sleep 0.5
+printf "filling %d MB with %d objects... " $STORE_MB $OBJECTS
+curl -s -x 127.0.0.1:$PROXY_PORT \
+    "http://127.0.0.1:$ORIGIN_PORT/$SIZE/[1-$OBJECTS]" >/dev/null
+kill -INT $proxy
+wait $proxy
+kill $origin
+wait $origin 2>/dev/null
+echo done
+
+for run in $(seq 1 $RUNS); do
+    start=$(date +%s%N)
+    ./proxy -c $STORE $PROXY_PORT >$OUT 2>/dev/null &
+    proxy=$!
+    while ! curl -s -f -o /dev/null -x 127.0.0.1:$PROXY_PORT \
+        http://127.0.0.1:$ORIGIN_PORT/$SIZE/$OBJECTS; do
+        sleep 0.001
+    done
+    end=$(date +%s%N)
+    kill -INT $proxy
+    wait $proxy
+    printf "run %d: %s, first hit after %.1f ms\n" $run \
+        "$(sed -n 's/^store [^:]*: //p' $OUT)" \
+        $(echo "$end $start" | awk '{ print ($1-$2)/1e6 }')
+done
+rm -f $STORE $OUT
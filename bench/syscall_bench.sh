@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# syscall_bench.sh: I/O calls the proxy makes per object, and its
+# throughput, for 1 MB bodies of random bytes and of 64 character
+# lines. Each object is a miss (no-store), fetched with curl one after
+# the other from bench/origin. There is no strace here, so the proxy
+# runs with bench/syscount.so preloaded, which counts its reads,
+# writes, splices, closes and the like (see bench/syscount.c). Pass
+# another build of the proxy to compare, e.g. one from before bodies
+# stopped being relayed line by line (user-014):
+#
+#   git worktree add /tmp/before "$(git rev-parse ':/^.user-014')~"
+#   make -C /tmp/before proxy
+#   bench/syscall_bench.sh /tmp/before/proxy
+#
+# The counts include curl's connection (accept, close, ...); the
+# throughput includes starting curl, which is most of it for 1 MB.
+#
+# usage: bench/syscall_bench.sh [proxy [objects]]   (default ./proxy
+# and 50), from the top directory after make and make bench
+#
+PROXY=${1:-./proxy}
+OBJECTS=${2:-50}
+SIZE=1048576
+ORIGIN_PORT=19080
+PROXY_PORT=19081
+COUNTS=/tmp/syscall_bench.$$
+# the counters of bench/syscount.so, in their order
+CALLS="read write readv writev recv send splice tee sendfile socket
+connect accept close shutdown setsockopt poll"
+
+bench/origin $ORIGIN_PORT &
+origin=$!
+SYSCOUNT_FILE=$COUNTS LD_PRELOAD=bench/syscount.so \
+    $PROXY $PROXY_PORT >/dev/null 2>&1 &
+proxy=$!
+sleep 0.5
+
+for kind in binary text; do
+    path=/nocache/$SIZE
+    [ $kind = text ] && path=/nocache/text/$SIZE
+    before=$(od -An -v -t d8 $COUNTS)
+    start=$(date +%s%N)
+    for i in $(seq 1 $OBJECTS); do
+        curl -s -o /dev/null -x 127.0.0.1:$PROXY_PORT \
+            http://127.0.0.1:$ORIGIN_PORT$path/$i
+    done
+    end=$(date +%s%N)
+    after=$(od -An -v -t d8 $COUNTS)
+    echo $CALLS $before $after | awk -v kind=$kind -v n=$OBJECTS \
+        -v ns=$((end-start)) -v size=$SIZE '{
+        ncalls = NF/3
+        for(i = 1; i <= ncalls; i++) {
+            d = $(2*ncalls+i) - $(ncalls+i)
+            total += d
+            if(d >= n/2)
+                detail = detail sprintf(" %s=%.1f", $i, d/n)
+        }
+        printf "%-6s calls/object=%.1f (%s ) MB/s=%.1f\n", kind,
+            total/n, detail, n*size/1048576/(ns/1e9) }'
+done
+kill $proxy $origin
+wait $proxy $origin 2>/dev/null
+rm -f $COUNTS
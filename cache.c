@@ -4,168 +4,329 @@
 	Name: Kaimin Huang
 	Andrew ID: kaiminh1
 
+A shard keeps its blocks in LRU lists and picks the blocks to evict
+by one of three policies, chosen at startup:
+
+CACHE_LRU keeps one list and evicts the least recently used block,
+giving a block hit since the last pass a second chance. Every new
+block is admitted, so a sweep over many urls asked for once flushes
+the blocks that are asked for all the time.
+
+CACHE_SLRU (segmented LRU) puts new blocks on probation and moves a
+block hit while on probation to the protected segment (at most
+CACHE_PROTECTED_PERCENT of the shard); only blocks on probation are
+evicted, and the protected segment pushes its least recently moved
+blocks back onto probation when it is full. A sweep only goes through
+probation.
+
+CACHE_TINYLFU (W-TinyLFU) puts new blocks in a small window (a
+CACHE_WINDOW_SHARE-th of the shard) and an SLRU behind it. A block
+the window pushes out is admitted into the SLRU only when its url is
+asked for more often than the block it would evict there, as counted
+by the shard's sketch (see sketch.c); otherwise it is evicted itself.
+The window lets a burst of new urls in, the admission keeps one-off
+urls from taking the place of popular ones.
+
+Hits take no lock, so they do not move their block: they only mark it
+as referenced, and the writer acts on the mark when the block comes up
+for eviction (a second chance with CACHE_LRU, the move to the
+protected segment with the others).
+
 ************************************************************/
 #include "cache.h"
+#include "slab.h"
+
+/*
+	The hash index is read by threads holding no lock, so the
+	pointers in it are loaded and published with atomic operations
+*/
+#define LOAD_PTR(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define STORE_PTR(p,v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+static size_t block_size(Cache_t* block);
+static void list_unlink(Cache_t* block, Cache_table_t* cache);
+static void list_push_front(Cache_t* block, Cache_table_t* cache);
+static Cache_index_t* new_index(size_t nbuckets);
+static void index_insert(Cache_t* block, Cache_table_t* cache);
+static void index_remove(Cache_t* block, Cache_table_t* cache);
+static void index_grow(Cache_table_t* cache);
+static void move_to_segment(Cache_t* block, int segment,
+	Cache_table_t* cache);
+static Cache_t* segment_victim(Cache_table_t* cache);
+static void tinylfu_insert(Cache_t* new_block, Cache_shard_t* shard,
+	Cache_t** evicted);
+
+/*
+	init_cache: set up an empty cache with an empty hash index, that
+	evicts by policy; protected_max is the budget of the protected
+	segment with CACHE_SLRU and CACHE_TINYLFU
+*/
+void init_cache(Cache_table_t* cache, Cache_policy_t policy,
+	size_t protected_max) {
+    memset(cache->lists, 0, sizeof(cache->lists));
+    cache->policy = policy;
+    cache->protected_max = protected_max;
+    cache->index = new_index(CACHE_INIT_BUCKETS);
+    cache->retired_index = NULL;
+    cache->nblocks = 0;
+    cache->total_cache_size = 0;
+}
+
+/*
+	cache_hash: 64-bit FNV-1a hash of the url
+*/
+unsigned long cache_hash(const char* url) {
+    unsigned long h = 14695981039346656037UL;
+    while(*url) {
+        h ^= (unsigned char)*url++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
 
 /*
 	construct_cache_block:
 		construct a new cache block and set the files of url, response,
 		response_size according to the input argument.
-		set the time stamp as 0,and next pointer as NULL;
-		return a pointer to the new block.
+		set the list pointers as NULL;
+		keeps_alive starts cleared, the caller may set it before the
+		block is inserted;
+		the block starts with the one reference owned by the cache,
+		its url and response are never changed after this.
+		the hash of the url is computed here once, outside any lock.
+		the block, its url and its response are one chunk of the slab
+		arena (see slab.c), right after each other.
+		return a pointer to the new block, NULL when the arena is
+		full.
 */
 
 Cache_t* construct_cache_block(char*  url, char* response,
 	size_t response_size) {
-    
-
-    Cache_t* new_cache= Malloc(sizeof(Cache_t));   
-    new_cache->url=Malloc(strlen(url)+1);
-
-    strcpy(new_cache->url,url);
-
-    new_cache->response = Malloc(response_size);
+    Cache_t* new_cache=new_cache_block(url,response_size);
 
+    if(new_cache==NULL)
+        return NULL;
     memcpy(new_cache->response,response,response_size);
-    new_cache->time_stamp=0;
     new_cache->response_size=response_size;
+    return new_cache;
+ }
+
+/*
+	new_cache_block: a block of url with room for a response of
+	capacity bytes and none in it yet. The caller reads the response
+	straight into it, adding to response_size, and inserts the block
+	as construct_cache_block's when it is complete.
+	return NULL when the arena is full, the response is not cached
+*/
+Cache_t* new_cache_block(char* url, size_t capacity) {
+    size_t url_size=strlen(url)+1;
+
+    Cache_t* new_cache=slab_alloc(sizeof(Cache_t)+url_size+capacity);
+    if(new_cache==NULL)
+        return NULL;
+    new_cache->url=(char*)(new_cache+1);
+    memcpy(new_cache->url,url,url_size);
+    new_cache->response=new_cache->url+url_size;
+    new_cache->response_size=0;
+    new_cache->capacity=capacity;
+    new_cache->hash=cache_hash(url);
+    new_cache->referenced=0;
+    new_cache->keeps_alive=0;
+    new_cache->expires=0;
+    new_cache->refresh_at=0;
+    new_cache->stale_until=0;
+    new_cache->hits=0;
+    new_cache->refreshing=0;
+    new_cache->refcnt=1;
+    new_cache->segment=CACHE_PROBATION;
+    new_cache->prev=NULL;
     new_cache->next=NULL;
-    
+    new_cache->hash_next=NULL;
+    return new_cache;
+}
+
+/*
+	grow_cache_block: move a block being filled to a chunk with room
+	for capacity bytes of response, the old one is freed
+	return the moved block
+	return NULL when the arena is full, the block is left as it is
+*/
+Cache_t* grow_cache_block(Cache_t* block, size_t capacity) {
+    size_t url_size=block->response-block->url;
+    Cache_t* new_cache;
 
+    if(capacity<=block->capacity)
+        return block;
+    new_cache=slab_alloc(sizeof(Cache_t)+url_size+capacity);
+    if(new_cache==NULL)
+        return NULL;
+    memcpy(new_cache,block,sizeof(Cache_t)+url_size+block->response_size);
+    new_cache->url=(char*)(new_cache+1);
+    new_cache->response=new_cache->url+url_size;
+    new_cache->capacity=capacity;
+    slab_free(block);
     return new_cache;
- }
+}
 
 /*
-	find_in_cache: given a url, find if it's in the cache.
+	find_in_cache: given a url and its hash(from cache_hash),
+	find if it's in the cache.
+	Only the hash bucket of the url is searched, and the full url
+	is compared only when the hash matches. A found block is marked
+	as referenced, so the next eviction pass keeps it.
+	It is safe to call without any lock inside shard_read_begin/end.
 	Return a pointer to the cache block when found it.
 	Return NULL when not found.
 */
  
-Cache_t* find_in_cache( char* url,Cache_t* cache) {
-   	
-   	Cache_t* p = cache;
+Cache_t* find_in_cache( char* url,unsigned long hash,Cache_table_t* cache) {
+    Cache_index_t* index = LOAD_PTR(cache->index);
+   	Cache_t* p = LOAD_PTR(index->buckets[hash & (index->nbuckets-1)]);
  
     while(p) {
-      
-        if( strcmp(url,p->url) == 0 ) {
-            
+        if(p->hash == hash && strcmp(url,p->url) == 0 ) {
+            if(!__atomic_load_n(&p->referenced, __ATOMIC_RELAXED))
+                __atomic_store_n(&p->referenced, 1, __ATOMIC_RELAXED);
             return p;
         }
-        p=p->next;
+        p=LOAD_PTR(p->hash_next);
     }
 
     return NULL;
 }
 
 /*
-	update_time_stamp: update the time stamp for all blocks in
-	the cache, for the hitted cache, set it's stamp as 0, for others
-	increase the time stamp by one. If there is a Miss(hit_cache==NULL)
-	increase all blocks' time stamp.
+	move_to_front: make a block the most recently used one
+	by moving it to the head of its LRU list
 */
 
-void update_time_stamp(Cache_t* hit_cache,Cache_t* cache) {
-	Cache_t* p=cache;
-	while(p) {
-		if(p == hit_cache)
-			p->time_stamp=0;
-		else
-			p->time_stamp=p->time_stamp+1;
-		p=p->next;
-	}
-	return;
+void move_to_front(Cache_t* hit_cache,Cache_table_t* cache) {
+    if(cache->lists[hit_cache->segment].head == hit_cache)
+        return;
+    list_unlink(hit_cache,cache);
+    list_push_front(hit_cache,cache);
 }
 
 /*
-	add_to_cache: add a new block to a cache
+	add_to_cache: add a new block to the front of a cache, index it
+	and update the total cache size. With CACHE_TINYLFU it goes to
+	the window, else on probation.
 */
-int add_to_cache(Cache_t *new_block,Cache_t** cache) {
-    new_block->next=*cache;
-    *cache = new_block;
+int add_to_cache(Cache_t *new_block,Cache_table_t* cache) {
+    new_block->segment=cache->policy==CACHE_TINYLFU? CACHE_WINDOW
+        : CACHE_PROBATION;
+    list_push_front(new_block,cache);
+    index_insert(new_block,cache);
+    cache->total_cache_size=cache->total_cache_size+block_size(new_block);
     return 1;
 }
 
 
 /*
-	evict_cache: evict a block, with the largest time stamp
-	(least-recently-used),and also update the total cache size;
-	return -1 when find some error
-	return 0 when success
+	evict_cache: evict the least-recently-used block (the tail of
+	the LRU list), and also update the total cache size.
+	Hits do not take the lock to move their block to the front, they
+	only mark it as referenced; a referenced tail block is moved to
+	the front here instead of being evicted (second chance).
+	With CACHE_SLRU and CACHE_TINYLFU the block is picked from the
+	segments instead (see segment_victim), never from the window.
+	The evicted block is only unlinked, readers may still be looking
+	at it, so the caller drops the cache's reference to it after a
+	grace period.
+	return NULL when there is no block to evict
+	return the evicted block when success
 
 */
 
-int evict_cache(size_t * total_cache_size,Cache_t** cache) {
-    printf("evict cache\n");
-    unsigned long time=0;
-    Cache_t* p;
-    Cache_t* cache_to_evic;
+Cache_t* evict_cache(Cache_table_t* cache) {
+    Cache_list_t* lru=&cache->lists[CACHE_PROBATION];
+    Cache_t* p=lru->tail;
+    size_t chances=cache->nblocks;
+
+    if(cache->policy!=CACHE_LRU)
+        p=segment_victim(cache);
+    else while(p && chances>0 &&
+        __atomic_load_n(&p->referenced, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&p->referenced, 0, __ATOMIC_RELAXED);
+        move_to_front(p,cache);
+        p=lru->tail;
+        chances--;
+    }
 
-    p=*cache;
     if(!p) {
         printf("no cache to evinc\n");
-        return -1;
-    }
-    //find the one to evict
-   	cache_to_evic=NULL;
-    while(p) {
-        if(p->time_stamp >=time) {
-            time=p->time_stamp;
-            cache_to_evic=p;
-        }
-        p=p->next;
+        return NULL;
     }
 
-    if(cache_to_evic==NULL) {
-        printf("cache_to_evic==NULL\n");
-        return -1;
-    }
+    remove_from_cache(p,cache);
+    return p;
+}
 
+/*
+	remove_from_cache: take a block out of the list and the index,
+	the caller drops the cache's reference to it
+*/
+void remove_from_cache(Cache_t* p,Cache_table_t* cache) {
+    list_unlink(p,cache);
+    index_remove(p,cache);
+    //update the cache size
+    cache->total_cache_size=cache->total_cache_size-block_size(p);
+}
 
-    //find the previous one block
-    p=*cache;
-    Cache_t* pre =NULL;
-    while(p!=cache_to_evic) {
-        pre=p;
-        p=p->next;
-    }
+/*
+	hold_cache_block: take a reference to a block, so it is not freed
+	while the response is written to a client. Only call it on a block
+	the caller already holds, or found inside shard_read_begin/end.
+*/
+void hold_cache_block(Cache_t* cache_block) {
+    __atomic_fetch_add(&cache_block->refcnt, 1, __ATOMIC_RELAXED);
+}
 
-    if(pre==NULL) {
-        *cache = p->next;
-    }
-    else{
-        pre->next=p->next;
-    }
-    //update the cache size and free the evicted one
-    *total_cache_size=*total_cache_size-(p->response_size);  
-    free_cache_block(p);     
-    return 0;
+/*
+	release_cache_block: drop a reference to a block, the last one
+	frees it
+*/
+void release_cache_block(Cache_t* cache_block) {
+    if(__atomic_sub_fetch(&cache_block->refcnt, 1, __ATOMIC_ACQ_REL)==0)
+        free_cache_block(cache_block);
 }
 
 /*
-	free_cache_block: free a given cache block
+	free_cache_block: free a given cache block, url and response go
+	with it
 */
 
 void free_cache_block(Cache_t* cache_block) {
     if(!cache_block)
         return;
-    Free(cache_block->url);
-    Free(cache_block->response);
-    Free(cache_block);
+    slab_free(cache_block);
 }
 
 
 /*
 	free_cache: free whole cache
 */
-void free_cache(Cache_t* cache) {
+void free_cache(Cache_table_t* cache) {
     printf("freeing cache\n");
-    Cache_t* p =cache;
+    Cache_t* p;
     Cache_t* block_to_free=NULL;
-    while(p){
-        block_to_free=p;
-        p=p->next;
-        free_cache_block(block_to_free);
+    int i;
+    for(i=0;i<CACHE_SEGMENTS;i++) {
+        p=cache->lists[i].head;
+        while(p){
+            block_to_free=p;
+            p=p->next;
+            free_cache_block(block_to_free);
+        }
     }
+    Free(cache->index);
+    if(cache->retired_index)
+        Free(cache->retired_index);
+    memset(cache->lists, 0, sizeof(cache->lists));
+    cache->index=NULL;
+    cache->retired_index=NULL;
+    cache->nblocks=0;
+    cache->total_cache_size=0;
     printf("free cache finished\n");
 }
 
@@ -175,18 +336,426 @@ void free_cache(Cache_t* cache) {
 	print_cache(for debugging):
 	print all the blocks in cache
 */
-void print_cache(size_t total_cache_size,Cache_t* cache) {
-    Cache_t* p =cache;
+void print_cache(Cache_table_t* cache) {
+    Cache_t* p;
     printf("print_cache_start********************************\n\n");
-    printf("total_cache_size=%ld\n",(unsigned long)total_cache_size);
-    printf("cache=%lx\n",(unsigned long)cache);
-    int i=0;
-    while(p) {
-        printf("cache_block[%d]\n",i);
-        printf("cache->time_stamp=%ld\n",p->time_stamp);
-        printf("cache->response_size=%ld\n",p->response_size);
-         i++;
-        p=p->next;
+    printf("total_cache_size=%ld\n",(unsigned long)cache->total_cache_size);
+    printf("nblocks=%ld nbuckets=%ld\n",(unsigned long)cache->nblocks,
+        (unsigned long)cache->index->nbuckets);
+    int i=0,segment;
+    for(segment=0;segment<CACHE_SEGMENTS;segment++) {
+        printf("segment[%d] size=%ld\n",segment,
+            (unsigned long)cache->lists[segment].size);
+        for(p=cache->lists[segment].head;p;p=p->next) {
+            printf("cache_block[%d]\n",i);
+            printf("cache->response_size=%ld\n",p->response_size);
+            i++;
+        }
     }
     printf("print_cache_end**********************************\n\n\n");
-}
\ No newline at end of file
+}
+
+
+/*
+	init_sharded_cache: set up nshards empty shards evicting by policy,
+	each one gets an equal part of max_cache_size as its budget; the
+	blocks come from a slab arena made for max_cache_size (see slab.c)
+*/
+void init_sharded_cache(Sharded_cache_t* cache,int nshards,
+	size_t max_cache_size,Cache_policy_t policy) {
+    int i;
+    if(nshards<1)
+        nshards=1;
+    if(nshards>MAX_CACHE_SHARDS)
+        nshards=MAX_CACHE_SHARDS;
+    init_slab_arena(max_cache_size);
+    cache->nshards=nshards;
+    cache->shards=Calloc(nshards,sizeof(Cache_shard_t));
+    for(i=0;i<nshards;i++) {
+        Cache_shard_t* shard=&cache->shards[i];
+        shard->max_size=max_cache_size/nshards;
+        if(policy==CACHE_TINYLFU) {
+            shard->window_max=shard->max_size/CACHE_WINDOW_SHARE;
+            shard->sketch=new_sketch(shard->max_size/CACHE_SKETCH_BYTES);
+        }
+        init_cache(&shard->table,policy,(shard->max_size-shard->window_max)
+            /100*CACHE_PROTECTED_PERCENT);
+        Sem_init(&shard->write_lock, 0, 1);
+        Sem_init(&shard->grace_lock, 0, 1);
+        shard->epoch=0;
+        shard->readers[0]=0;
+        shard->readers[1]=0;
+    }
+}
+
+/*
+	select_shard: pick the shard of a url by its hash. The high bits
+	are used, since the low bits already pick the bucket in the shard.
+	FNV-1a only carries the last bytes of the url into the low bits,
+	so urls that differ in their end (/img/1.png, /img/2.png) would
+	share their high bits; multiplying by 2^64/phi first spreads the
+	low bits over the high ones.
+*/
+Cache_shard_t* select_shard(unsigned long hash,Sharded_cache_t* cache) {
+    return &cache->shards[((hash*0x9e3779b97f4a7c15UL)>>32)%cache->nshards];
+}
+
+/*
+	shard_read_begin/shard_read_end: enter and leave a shard as a
+	reader. No lock is taken, the reader is only counted in the
+	current epoch; pass the value returned by shard_read_begin to
+	shard_read_end. Blocks found in between stay valid until
+	shard_read_end, hold_cache_block keeps one valid after it.
+*/
+int shard_read_begin(Cache_shard_t* shard) {
+    int epoch=__atomic_load_n(&shard->epoch, __ATOMIC_SEQ_CST)&1;
+    __atomic_fetch_add(&shard->readers[epoch], 1, __ATOMIC_SEQ_CST);
+    return epoch;
+}
+
+void shard_read_end(Cache_shard_t* shard,int epoch) {
+    __atomic_fetch_sub(&shard->readers[epoch], 1, __ATOMIC_RELEASE);
+}
+
+/*
+	shard_synchronize: wait for a grace period, i.e. until every
+	reader that entered the shard before this call has left it.
+	New readers are sent to the other counter and the old one is
+	drained; this is done twice, so a reader that read the epoch
+	just before a flip but counted itself just after is drained too.
+*/
+void shard_synchronize(Cache_shard_t* shard) {
+    int i,old;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    P(&shard->grace_lock);
+    for(i=0;i<2;i++) {
+        old=__atomic_fetch_add(&shard->epoch, 1, __ATOMIC_SEQ_CST)&1;
+        while(__atomic_load_n(&shard->readers[old], __ATOMIC_SEQ_CST)!=0)
+            usleep(50);
+    }
+    V(&shard->grace_lock);
+}
+
+/*
+	lookup_shard: find a url in a shard and take a reference to the
+	block, so the reader leaves the shard right away and can take its
+	time writing the response. The caller releases the block.
+	Every lookup, found or not, is counted in the shard's sketch.
+	Return NULL when not found.
+*/
+Cache_t* lookup_shard(char* url,unsigned long hash,Cache_shard_t* shard) {
+    int epoch=shard_read_begin(shard);
+    Cache_t* p=find_in_cache(url,hash,&shard->table);
+    if(p)
+        hold_cache_block(p);
+    shard_read_end(shard,epoch);
+    if(shard->sketch)
+        sketch_add(shard->sketch,hash);
+    __atomic_fetch_add(&shard->lookups, 1, __ATOMIC_RELAXED);
+    if(p) {
+        __atomic_fetch_add(&shard->hits, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&shard->hit_bytes, p->response_size,
+            __ATOMIC_RELAXED);
+    }
+    return p;
+}
+
+/*
+	insert_to_shard: evict from the shard until the new block fits in
+	its budget, then add the block. A block of the same url already
+	in the shard is replaced, so a url is never cached twice. Takes
+	the shard's write lock; the cache's references to the evicted and
+	replaced blocks are dropped after a grace period, outside it. A
+	block still being written to a client is freed by that client.
+	With CACHE_TINYLFU the block always enters the window, what
+	leaves the window has to be admitted (see tinylfu_insert).
+	return 0 when the block is added
+	return -1 when the block cannot fit, the cache's reference to the
+	block is dropped
+*/
+int insert_to_shard(Cache_t* new_block,Cache_shard_t* shard) {
+    Cache_t* evicted=NULL;
+    Cache_t* p;
+    Cache_index_t* retired;
+    int rc=0;
+
+    __atomic_fetch_add(&shard->miss_bytes, new_block->response_size,
+        __ATOMIC_RELAXED);
+    if(block_size(new_block)>shard->max_size) {
+        release_cache_block(new_block);
+        return -1;
+    }
+    P(&shard->write_lock);
+    if((p=find_in_cache(new_block->url,new_block->hash,&shard->table))) {
+        remove_from_cache(p,&shard->table);
+        p->next=evicted;
+        evicted=p;
+    }
+    if(shard->table.policy==CACHE_TINYLFU)
+        tinylfu_insert(new_block,shard,&evicted);
+    else while(shard->table.total_cache_size+block_size(new_block)
+        >shard->max_size) {
+        //evict to get enough space
+        if((p=evict_cache(&shard->table))==NULL) {
+            fprintf(stderr, "cache evict error\n");
+            rc=-1;
+            break;
+        }
+        p->next=evicted;
+        evicted=p;
+    }
+    if(rc==0&&shard->table.policy!=CACHE_TINYLFU)
+        add_to_cache(new_block,&shard->table);
+    retired=shard->table.retired_index;
+    shard->table.retired_index=NULL;
+    V(&shard->write_lock);
+
+    if(rc==-1)
+        release_cache_block(new_block);
+    if(evicted||retired) {
+        shard_synchronize(shard);
+        while(evicted) {
+            p=evicted;
+            evicted=evicted->next;
+            release_cache_block(p);
+        }
+        if(retired)
+            Free(retired);
+    }
+    return rc;
+}
+
+/*
+	free_sharded_cache: free all shards
+*/
+void free_sharded_cache(Sharded_cache_t* cache) {
+    int i;
+    for(i=0;i<cache->nshards;i++) {
+        free_cache(&cache->shards[i].table);
+        free_sketch(cache->shards[i].sketch);
+    }
+    Free(cache->shards);
+    cache->shards=NULL;
+    cache->nshards=0;
+}
+
+/*
+	print_cache_stats: print the lookup counters of all shards, with
+	the share of the lookups and of the response bytes that were hits,
+	only uses the async-signal-safe sio functions
+*/
+void print_cache_stats(Sharded_cache_t* cache) {
+    long lookups=0,hits=0,hit_bytes=0,miss_bytes=0,rejected=0;
+    int i;
+
+    for(i=0;i<cache->nshards;i++) {
+        Cache_shard_t* shard=&cache->shards[i];
+        lookups+=__atomic_load_n(&shard->lookups, __ATOMIC_RELAXED);
+        hits+=__atomic_load_n(&shard->hits, __ATOMIC_RELAXED);
+        hit_bytes+=__atomic_load_n(&shard->hit_bytes, __ATOMIC_RELAXED);
+        miss_bytes+=__atomic_load_n(&shard->miss_bytes, __ATOMIC_RELAXED);
+        rejected+=__atomic_load_n(&shard->rejected, __ATOMIC_RELAXED);
+    }
+    sio_puts("cache: lookups=");
+    sio_putl(lookups);
+    sio_puts(" hits=");
+    sio_putl(hits);
+    sio_puts(" hit_ratio=");
+    sio_putl(lookups? hits*100/lookups : 0);
+    sio_puts("% byte_hit_ratio=");
+    sio_putl(hit_bytes+miss_bytes? hit_bytes*100/(hit_bytes+miss_bytes) : 0);
+    sio_puts("% rejected=");
+    sio_putl(rejected);
+    sio_puts("\n");
+}
+
+/*
+	block_size: the bytes a block takes in the slab arena, what its
+	shard is charged for it
+*/
+static size_t block_size(Cache_t* block) {
+    return slab_chunk_size(sizeof(Cache_t)+(block->response-block->url)+
+        block->capacity);
+}
+
+/*
+	list_unlink: take a block out of the LRU list of its segment
+*/
+static void list_unlink(Cache_t* block, Cache_table_t* cache) {
+    Cache_list_t* list = &cache->lists[block->segment];
+    if(block->prev)
+        block->prev->next = block->next;
+    else
+        list->head = block->next;
+    if(block->next)
+        block->next->prev = block->prev;
+    else
+        list->tail = block->prev;
+    list->size -= block_size(block);
+    block->prev = NULL;
+    block->next = NULL;
+}
+
+/*
+	list_push_front: put a block at the head of the LRU list of its
+	segment
+*/
+static void list_push_front(Cache_t* block, Cache_table_t* cache) {
+    Cache_list_t* list = &cache->lists[block->segment];
+    block->prev = NULL;
+    block->next = list->head;
+    if(list->head)
+        list->head->prev = block;
+    else
+        list->tail = block;
+    list->head = block;
+    list->size += block_size(block);
+}
+
+/*
+	move_to_segment: move a block to the head of another segment
+*/
+static void move_to_segment(Cache_t* block, int segment,
+	Cache_table_t* cache) {
+    list_unlink(block,cache);
+    block->segment = segment;
+    list_push_front(block,cache);
+}
+
+/*
+	segment_victim: the block to evict with CACHE_SLRU and
+	CACHE_TINYLFU, it is not taken out of the cache. Referenced blocks
+	at the tail of probation are moved to the protected segment on the
+	way, and the protected segment pushes its tail back onto probation
+	while it is over its budget.
+	return NULL when there is no block on probation nor protected
+*/
+static Cache_t* segment_victim(Cache_table_t* cache) {
+    Cache_list_t* probation = &cache->lists[CACHE_PROBATION];
+    Cache_list_t* protected = &cache->lists[CACHE_PROTECTED];
+    size_t chances = cache->nblocks;
+    Cache_t* p;
+
+    while((p = probation->tail) && chances > 0 &&
+        __atomic_load_n(&p->referenced, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&p->referenced, 0, __ATOMIC_RELAXED);
+        move_to_segment(p,CACHE_PROTECTED,cache);
+        while(protected->size > cache->protected_max && protected->tail != p)
+            move_to_segment(protected->tail,CACHE_PROBATION,cache);
+        chances--;
+    }
+    return p? p : protected->tail;
+}
+
+/*
+	tinylfu_insert: add a block to the window of a CACHE_TINYLFU shard.
+	The blocks the window pushes out over its budget go on probation
+	when there is room, or when their url is asked for more often than
+	each block they evict there; otherwise they are evicted. Called
+	with the shard's write lock held, the blocks taken out of the
+	cache are put on *evicted.
+*/
+static void tinylfu_insert(Cache_t* new_block, Cache_shard_t* shard,
+	Cache_t** evicted) {
+    Cache_table_t* table = &shard->table;
+    Cache_list_t* window = &table->lists[CACHE_WINDOW];
+    Cache_t *candidate,*victim;
+
+    add_to_cache(new_block,table);
+    while(table->total_cache_size > shard->max_size ||
+        (window->size > shard->window_max && window->tail != new_block)) {
+        if(window->size > shard->window_max && window->tail != new_block) {
+            candidate = window->tail;
+            move_to_segment(candidate,CACHE_PROBATION,table);
+            while(table->total_cache_size > shard->max_size) {
+                victim = segment_victim(table);
+                if(victim == candidate ||
+                    sketch_estimate(shard->sketch,candidate->hash) <=
+                    sketch_estimate(shard->sketch,victim->hash)) {
+                    victim = candidate; // not admitted
+                    __atomic_fetch_add(&shard->rejected, 1, __ATOMIC_RELAXED);
+                }
+                remove_from_cache(victim,table);
+                victim->next = *evicted;
+                *evicted = victim;
+                if(victim == candidate)
+                    break;
+            }
+        }
+        else {
+            // the window is within its budget, room is made behind it,
+            // or in it once the rest is empty
+            if((victim = segment_victim(table)) == NULL)
+                victim = window->tail;
+            remove_from_cache(victim,table);
+            victim->next = *evicted;
+            *evicted = victim;
+        }
+    }
+}
+
+/*
+	new_index: allocate an empty hash index
+*/
+static Cache_index_t* new_index(size_t nbuckets) {
+    Cache_index_t* index = Calloc(1, sizeof(Cache_index_t)
+        +nbuckets*sizeof(Cache_t*));
+    index->nbuckets = nbuckets;
+    return index;
+}
+
+/*
+	index_insert: put a block into its hash bucket, grow the index
+	when the average chain length would exceed one. The block is
+	filled in before it is published to the readers.
+*/
+static void index_insert(Cache_t* block, Cache_table_t* cache) {
+    if(cache->nblocks+1 > cache->index->nbuckets)
+        index_grow(cache);
+    Cache_index_t* index = cache->index;
+    size_t i = block->hash & (index->nbuckets-1);
+    block->hash_next = index->buckets[i];
+    STORE_PTR(index->buckets[i], block);
+    cache->nblocks++;
+}
+
+/*
+	index_remove: unlink a block from its hash bucket. The block's
+	own hash_next is kept, a reader standing on it can go on.
+*/
+static void index_remove(Cache_t* block, Cache_table_t* cache) {
+    Cache_index_t* index = cache->index;
+    Cache_t** pp = &index->buckets[block->hash & (index->nbuckets-1)];
+    while(*pp) {
+        if(*pp == block) {
+            STORE_PTR(*pp, block->hash_next);
+            cache->nblocks--;
+            return;
+        }
+        pp = &(*pp)->hash_next;
+    }
+}
+
+/*
+	index_grow: double the number of buckets and rehash all blocks.
+	A reader walking the old index while blocks are moved may miss a
+	block (and fetch it from the server) but never loops or crashes.
+	The old index is freed by the writer after a grace period.
+*/
+static void index_grow(Cache_table_t* cache) {
+    Cache_index_t* old = cache->index;
+    Cache_index_t* index = new_index(old->nbuckets*2);
+    size_t i;
+    for(i=0; i<old->nbuckets; i++) {
+        Cache_t* p = old->buckets[i];
+        while(p) {
+            Cache_t* next = p->hash_next;
+            size_t j = p->hash & (index->nbuckets-1);
+            STORE_PTR(p->hash_next, index->buckets[j]);
+            index->buckets[j] = p;
+            p = next;
+        }
+    }
+    STORE_PTR(cache->index, index);
+    cache->retired_index = old;
+}
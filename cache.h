@@ -10,6 +10,42 @@
 #define __CACHE_H__
 
 #include "csapp.h"
+#include "sketch.h"
+
+/* initial number of buckets in the hash index (power of two) */
+#define CACHE_INIT_BUCKETS 64
+/* upper bound on the number of cache shards */
+#define MAX_CACHE_SHARDS 64
+/* first room for the response of a block being filled */
+#define CACHE_FILL_CHUNK 4096
+/* with TinyLFU, the window takes 1/CACHE_WINDOW_SHARE of a shard */
+#define CACHE_WINDOW_SHARE 100
+/* with SLRU and TinyLFU, the protected segment takes this percent of
+   the blocks that are not in the window */
+#define CACHE_PROTECTED_PERCENT 80
+/* a shard's sketch has a counter in each row for every this many
+   bytes of its budget */
+#define CACHE_SKETCH_BYTES 256
+
+/*
+	How a shard picks the blocks it keeps
+*/
+enum cache_policy {
+    CACHE_LRU, // every block is kept, the least recently used goes
+    CACHE_SLRU, // blocks hit again are protected from one-off ones
+    CACHE_TINYLFU // W-TinyLFU: a window, then admission by frequency
+};
+typedef enum cache_policy  Cache_policy_t;
+
+/*
+	The lists a block can be on, with CACHE_LRU all are on probation
+*/
+enum cache_segment {
+    CACHE_PROBATION, // new blocks, and the protected ones pushed out
+    CACHE_PROTECTED, // blocks hit while on probation
+    CACHE_WINDOW, // with CACHE_TINYLFU, the newest blocks
+    CACHE_SEGMENTS
+};
 
 /*
 	The cache block structure
@@ -17,22 +53,125 @@
 struct cache_struc {
     char*  url; // url for idendify the request
     char*  response; // store the response from server
-    unsigned long time_stamp; //record the time information
     size_t response_size; // record the size of the response(number of bytes)
-    struct cache_struc* next; // pointer to the next cache block
+    size_t capacity; // room for the response, while the block is filled
+    unsigned long hash; // precomputed hash of the url
+    int referenced; // set by a hit, gives the block a second chance
+    int keeps_alive; // the response lets the client connection stay open
+    time_t expires; // when it stops being fresh, 0 when it never was
+    time_t refresh_at; // from then on a hot block is refreshed ahead
+    time_t stale_until; // until then it may be sent stale, while refreshed
+    int hits; // hits while fresh, tell if it is hot
+    int refreshing; // a background refresh of it is queued or running
+    int refcnt; // references: one from the cache, one per client writing
+    int segment; // the list it is on, an enum cache_segment
+    struct cache_struc* prev; // more recently used block in its list
+    struct cache_struc* next; // less recently used block in its list
+    struct cache_struc* hash_next; // next block in the same hash bucket
 };
 typedef struct cache_struc  Cache_t;
 
+/*
+	The hash index: the bucket count lives with the buckets, so a
+	reader always sees a matching pair when the index is replaced
+*/
+struct cache_index {
+    size_t nbuckets; // number of buckets (power of two)
+    Cache_t* buckets[]; // chained through hash_next
+};
+typedef struct cache_index  Cache_index_t;
+
+/*
+	One LRU list of cache blocks, most recently used at the head
+*/
+struct cache_list {
+    Cache_t* head; // most recently used block
+    Cache_t* tail; // least recently used block, evicted first
+    size_t size; // sum of the block sizes (see block_size)
+};
+typedef struct cache_list  Cache_list_t;
+
+/*
+	The cache structure: doubly linked LRU lists of cache blocks, one
+	per segment of the policy, plus a hash index over them, so lookup,
+	promotion and eviction are all constant time
+*/
+struct cache_table {
+    Cache_list_t lists[CACHE_SEGMENTS]; // by enum cache_segment
+    Cache_policy_t policy;
+    size_t protected_max; // budget of the protected segment
+    Cache_index_t* index; // hash index, read without any lock
+    Cache_index_t* retired_index; // old index after a grow, to be freed
+    size_t nblocks; // number of blocks in the cache
+    size_t total_cache_size; // sum of the block sizes (see block_size)
+};
+typedef struct cache_table  Cache_table_t;
+
+/*
+	A cache shard: one LRU table with its own size budget.
+	Readers do not take any lock: they only announce themselves in
+	the readers counter of the current epoch. Writers are serialized
+	by write_lock, and the cache's reference to a block a writer
+	removes is dropped only after every reader that could still see
+	it has left (a grace period).
+*/
+struct cache_shard {
+    Cache_table_t table; // the LRU lists and hash index of this shard
+    size_t max_size; // this shard's part of the whole cache size
+    size_t window_max; // budget of the window, with CACHE_TINYLFU
+    Sketch_t* sketch; // how often urls are asked, with CACHE_TINYLFU
+    sem_t write_lock; // serializes the writers of the shard
+    sem_t grace_lock; // serializes waiting for grace periods
+    unsigned long epoch; // the low bit picks the counter new readers use
+    long readers[2]; // number of readers in the shard, by epoch
+    /* counters for print_cache_stats */
+    long lookups; // urls looked up
+    long hits; // urls found
+    long hit_bytes; // response bytes found
+    long miss_bytes; // response bytes of the blocks offered to it
+    long rejected; // blocks TinyLFU did not admit
+};
+typedef struct cache_shard  Cache_shard_t;
+
+/*
+	The whole cache: the shards a url is spread over by its hash
+*/
+struct sharded_cache {
+    Cache_shard_t* shards;
+    int nshards;
+};
+typedef struct sharded_cache  Sharded_cache_t;
+
 
 /* declare functions for cache operation */
+void init_cache(Cache_table_t* cache, Cache_policy_t policy,
+	size_t protected_max);
+unsigned long cache_hash(const char* url);
 Cache_t* construct_cache_block(char*  url, char* response,
 	size_t response_size);
-Cache_t* find_in_cache( char* url,Cache_t* cache);
-int add_to_cache(Cache_t *p,Cache_t** cache);
-int evict_cache(size_t * total_cache_size,Cache_t** cache);
+Cache_t* new_cache_block(char* url, size_t capacity);
+Cache_t* grow_cache_block(Cache_t* block, size_t capacity);
+Cache_t* find_in_cache( char* url,unsigned long hash,Cache_table_t* cache);
+int add_to_cache(Cache_t *p,Cache_table_t* cache);
+Cache_t* evict_cache(Cache_table_t* cache);
+void remove_from_cache(Cache_t* p,Cache_table_t* cache);
 void free_cache_block(Cache_t* cache_block);
-void free_cache(Cache_t* cache);
-void print_cache(size_t total_cache_size,Cache_t* cache);
-void update_time_stamp(Cache_t* hit_cache,Cache_t* cache);
+void free_cache(Cache_table_t* cache);
+void print_cache(Cache_table_t* cache);
+void move_to_front(Cache_t* hit_cache,Cache_table_t* cache);
+void hold_cache_block(Cache_t* cache_block);
+void release_cache_block(Cache_t* cache_block);
+
+/* declare functions for the sharded cache */
+void init_sharded_cache(Sharded_cache_t* cache,int nshards,
+	size_t max_cache_size,Cache_policy_t policy);
+Cache_shard_t* select_shard(unsigned long hash,Sharded_cache_t* cache);
+int shard_read_begin(Cache_shard_t* shard);
+void shard_read_end(Cache_shard_t* shard,int epoch);
+void shard_synchronize(Cache_shard_t* shard);
+Cache_t* lookup_shard(char* url,unsigned long hash,Cache_shard_t* shard);
+int insert_to_shard(Cache_t* new_block,Cache_shard_t* shard);
+void free_sharded_cache(Sharded_cache_t* cache);
+void print_cache_stats(Sharded_cache_t* cache);
 
 #endif /* __CACHE_H__ */
@@ -0,0 +1,176 @@
+/************************************************************
+	connect.c
+	Racing connects to the addresses of a server
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+Trying the addresses of a server one by one with a blocking connect
+means an address that never answers (say an unreachable IPv6 one)
+holds up the request for the whole kernel connect timeout. Here the
+connects are non-blocking and started CONNECT_ATTEMPT_DELAY apart,
+the earlier ones keep running, and the first to finish wins (the
+"happy eyeballs" of RFC 8305). The address families take turns,
+starting with the one that connected last time to this server.
+
+************************************************************/
+#include <poll.h>
+#include <time.h>
+#include "connect.h"
+
+/*
+	One connect attempt that is running
+*/
+struct attempt {
+    int fd;
+    int family;
+    long deadline; // when it is given up, in milliseconds
+};
+
+static int order_addresses(struct addrinfo* addrs, int prefer_family,
+	struct addrinfo** order);
+static int start_attempt(struct addrinfo* p);
+static long now_ms(void);
+
+
+/*
+	race_connect: connect to one of addrs, racing the attempts as
+	described above; prefer_family is tried first, AF_UNSPEC to keep
+	the order of getaddrinfo. family is set to the family of the
+	address that connected.
+	return the connected descriptor, in blocking mode
+	return -1 and set errno when no address connected
+*/
+int race_connect(struct addrinfo* addrs, int prefer_family, int* family) {
+    struct addrinfo* order[MAX_CONNECT_ATTEMPTS];
+    struct attempt running[MAX_CONNECT_ATTEMPTS];
+    struct pollfd pfds[MAX_CONNECT_ATTEMPTS];
+    int naddrs,next=0,nrunning=0,i,j,rc,fd,err=ETIMEDOUT;
+    long now,next_start=0,timeout;
+    socklen_t len;
+
+    naddrs=order_addresses(addrs,prefer_family,order);
+    while(next<naddrs||nrunning>0) {
+        now=now_ms();
+        // start the next address when it is time, or nothing is left
+        if(next<naddrs&&(nrunning==0||now>=next_start)) {
+            if((fd=start_attempt(order[next]))>=0) {
+                running[nrunning].fd=fd;
+                running[nrunning].family=order[next]->ai_family;
+                running[nrunning].deadline=now+CONNECT_TIMEOUT;
+                nrunning++;
+            }
+            else
+                err=errno;
+            next++;
+            next_start=now+CONNECT_ATTEMPT_DELAY;
+            continue;
+        }
+
+        // wait for an attempt to finish, time out, or the next start
+        timeout=next<naddrs? next_start-now : CONNECT_TIMEOUT;
+        for(i=0;i<nrunning;i++) {
+            if(running[i].deadline-now<timeout)
+                timeout=running[i].deadline-now;
+            pfds[i].fd=running[i].fd;
+            pfds[i].events=POLLOUT;
+            pfds[i].revents=0;
+        }
+        if((rc=poll(pfds,nrunning,timeout>0? timeout : 0))<0) {
+            if(errno==EINTR)
+                continue;
+            err=errno;
+            break;
+        }
+
+        now=now_ms();
+        // from the end, so moving the last attempt into a hole is safe
+        for(i=nrunning-1;i>=0;i--) {
+            if(pfds[i].revents) {
+                len=sizeof(err);
+                if(getsockopt(running[i].fd,SOL_SOCKET,SO_ERROR,&err,&len)<0)
+                    err=errno;
+                if(err==0) {
+                    // the winner, the others are not needed
+                    fd=running[i].fd;
+                    *family=running[i].family;
+                    for(j=0;j<nrunning;j++) {
+                        if(j!=i)
+                            close(running[j].fd);
+                    }
+                    fcntl(fd,F_SETFL,fcntl(fd,F_GETFL,0)&~O_NONBLOCK);
+                    return fd;
+                }
+            }
+            else if(now<running[i].deadline)
+                continue;
+            else
+                err=ETIMEDOUT;
+            close(running[i].fd);
+            running[i]=running[--nrunning];
+        }
+    }
+
+    for(i=0;i<nrunning;i++)
+        close(running[i].fd);
+    errno=err;
+    return -1;
+}
+
+
+/*
+	order_addresses: put the addresses in the order they are tried,
+	the families taking turns, prefer_family first (or the family of
+	the first address). At most MAX_CONNECT_ATTEMPTS are kept.
+	return the number of addresses in order
+*/
+static int order_addresses(struct addrinfo* addrs, int prefer_family,
+	struct addrinfo** order) {
+    struct addrinfo *same[MAX_CONNECT_ATTEMPTS],*other[MAX_CONNECT_ATTEMPTS];
+    struct addrinfo* p;
+    int nsame=0,nother=0,n=0,i;
+
+    if(prefer_family==AF_UNSPEC&&addrs)
+        prefer_family=addrs->ai_family;
+    for(p=addrs;p;p=p->ai_next) {
+        if(p->ai_family==prefer_family) {
+            if(nsame<MAX_CONNECT_ATTEMPTS)
+                same[nsame++]=p;
+        }
+        else if(nother<MAX_CONNECT_ATTEMPTS)
+            other[nother++]=p;
+    }
+    for(i=0;(i<nsame||i<nother)&&n<MAX_CONNECT_ATTEMPTS;i++) {
+        if(i<nsame)
+            order[n++]=same[i];
+        if(i<nother&&n<MAX_CONNECT_ATTEMPTS)
+            order[n++]=other[i];
+    }
+    return n;
+}
+
+/*
+	start_attempt: start a non-blocking connect to one address
+	return the descriptor, -1 on error
+*/
+static int start_attempt(struct addrinfo* p) {
+    int fd=socket(p->ai_family,p->ai_socktype|SOCK_NONBLOCK,p->ai_protocol);
+
+    if(fd<0)
+        return -1;
+    if(connect(fd,p->ai_addr,p->ai_addrlen)<0&&errno!=EINPROGRESS) {
+        int err=errno;
+        close(fd);
+        errno=err;
+        return -1;
+    }
+    return fd;
+}
+
+/*
+	now_ms: a clock in milliseconds for the deadlines
+*/
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
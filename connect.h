@@ -0,0 +1,23 @@
+/************************************************************
+	connect.h
+	Racing connects to the addresses of a server
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __CONNECT_H__
+#define __CONNECT_H__
+
+#include "csapp.h"
+
+/* milliseconds before the next address is tried beside the running ones */
+#define CONNECT_ATTEMPT_DELAY 250
+/* milliseconds one connect attempt may take */
+#define CONNECT_TIMEOUT 5000
+/* addresses tried for one connection */
+#define MAX_CONNECT_ATTEMPTS 16
+
+int race_connect(struct addrinfo* addrs, int prefer_family, int* family);
+
+#endif /* __CONNECT_H__ */
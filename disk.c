@@ -0,0 +1,266 @@
+/************************************************************
+	disk.c
+	A disk-backed cache tier for large objects
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+The memory cache only takes objects under MAX_OBJECT_SIZE. With -d,
+larger responses (up to 1/DISK_OBJECT_SHARE of the disk budget) are
+also written to a file in the given directory while they are relayed,
+and later requests for them are answered with sendfile straight from
+the page cache to the client, without going through user space.
+
+The files are indexed by url in a hash table and kept in LRU order
+under their own size budget. Lookups are rare next to the memory
+cache's, so one lock protects the whole tier. An evicted file is
+unlinked at once; a client still being sent it holds it open, so
+its data stays until the send is done.
+
+************************************************************/
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "csapp.h"
+#include "cache.h"
+#include "disk.h"
+
+/*
+	One object on disk
+*/
+struct disk_entry {
+    char* url;
+    unsigned long hash;
+    char path[MAXLINE]; // the file with the whole response
+    long size;
+    bool keeps_alive; // the response lets the client connection stay open
+    time_t expires; // when it stops being fresh
+    struct disk_entry* prev; // more recently used entry
+    struct disk_entry* next; // less recently used entry
+    struct disk_entry* hash_next; // next entry in the same bucket
+};
+
+static struct {
+    char dir[MAXLINE];
+    long max_size; // size budget, 0 when the tier is off
+    long total_size;
+    long next_id; // names the files
+    struct disk_entry *head,*tail; // LRU list, most recent first
+    struct disk_entry* buckets[DISK_BUCKETS];
+    sem_t lock; // protects all of the above
+} disk;
+
+static struct disk_entry* find_entry(char* url, unsigned long hash);
+static void unlink_entry(struct disk_entry* e);
+static void push_front(struct disk_entry* e);
+static void free_entry(struct disk_entry* e);
+
+
+/*
+	init_disk_cache: keep large objects in files under dir, at most
+	max_size bytes in all; dir is made when it does not exist
+	return -1 when dir cannot be used
+*/
+int init_disk_cache(char* dir, long max_size) {
+    struct stat st;
+
+    if(mkdir(dir,0700)<0&&errno!=EEXIST)
+        return -1;
+    if(stat(dir,&st)<0||!S_ISDIR(st.st_mode)||access(dir,W_OK)<0)
+        return -1;
+    if(strlen(dir)>MAXLINE-64)
+        return -1;
+    strcpy(disk.dir,dir);
+    disk.max_size=max_size;
+    Sem_init(&disk.lock,0,1);
+    return 0;
+}
+
+/*
+	disk_cache_enabled: whether the disk tier is on
+*/
+bool disk_cache_enabled(void) {
+    return disk.max_size>0;
+}
+
+/*
+	disk_max_object: the largest response the disk tier takes
+*/
+long disk_max_object(void) {
+    return disk.max_size/DISK_OBJECT_SHARE;
+}
+
+/*
+	disk_send: send the response of url to client from its file, if
+	the disk tier has it and it is still fresh
+	return 1 when sent
+	return 0 when the disk tier does not have it, or not fresh
+	return -1 when write to client error
+*/
+int disk_send(int clientfd, char* url, bool* keeps_alive) {
+    char path[MAXLINE];
+    unsigned long hash=cache_hash(url);
+    struct disk_entry* e;
+    off_t off=0;
+    long size;
+    ssize_t n;
+    int fd;
+
+    if(!disk_cache_enabled())
+        return 0;
+    P(&disk.lock);
+    if((e=find_entry(url,hash))==NULL||e->expires<=time(NULL)) {
+        V(&disk.lock);
+        return 0;
+    }
+    unlink_entry(e);
+    push_front(e);
+    strcpy(path,e->path);
+    size=e->size;
+    *keeps_alive=e->keeps_alive;
+    V(&disk.lock);
+
+    // it may have been evicted meanwhile, then it is just a miss
+    if((fd=open(path,O_RDONLY))<0)
+        return 0;
+    while(off<size) {
+        n=sendfile(clientfd,fd,&off,size-off);
+        if(n<0&&errno==EINTR)
+            continue;
+        if(n<=0) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    return 1;
+}
+
+/*
+	disk_begin_fill: make a new file for a response that is being
+	relayed, its name is put in path (MAXLINE bytes)
+	return the descriptor, -1 on error
+*/
+int disk_begin_fill(char* path) {
+    long id;
+
+    P(&disk.lock);
+    id=disk.next_id++;
+    V(&disk.lock);
+    if(snprintf(path,MAXLINE,"%s/%d-%ld.obj",disk.dir,(int)getpid(),id)
+        >=MAXLINE)
+        return -1;
+    return open(path,O_WRONLY|O_CREAT|O_TRUNC,0600);
+}
+
+/*
+	disk_end_fill: close a file made by disk_begin_fill. When the
+	whole response of size bytes is in it, it becomes the entry of
+	url until expires, replacing an older one, and the least
+	recently used files are evicted to stay in the budget; otherwise
+	it is removed.
+*/
+void disk_end_fill(int fd, char* path, char* url, long size,
+	bool keeps_alive, time_t expires, bool complete) {
+    unsigned long hash;
+    struct disk_entry *e,*old;
+
+    if(close(fd)<0||!complete||size>disk_max_object()) {
+        unlink(path);
+        return;
+    }
+    hash=cache_hash(url);
+    e=Calloc(1,sizeof(struct disk_entry));
+    e->url=Malloc(strlen(url)+1);
+    strcpy(e->url,url);
+    e->hash=hash;
+    strcpy(e->path,path);
+    e->size=size;
+    e->keeps_alive=keeps_alive;
+    e->expires=expires;
+
+    P(&disk.lock);
+    if((old=find_entry(url,hash))!=NULL) {
+        unlink_entry(old);
+        free_entry(old);
+    }
+    while(disk.tail&&disk.total_size+size>disk.max_size) {
+        old=disk.tail;
+        unlink_entry(old);
+        free_entry(old);
+    }
+    push_front(e);
+    V(&disk.lock);
+}
+
+/*
+	free_disk_cache: remove every file of the disk tier
+*/
+void free_disk_cache(void) {
+    struct disk_entry* e;
+
+    if(!disk_cache_enabled())
+        return;
+    while((e=disk.head)!=NULL) {
+        unlink_entry(e);
+        free_entry(e);
+    }
+}
+
+
+/*
+	find_entry: the entry of url, NULL when there is none.
+	Called with the lock held.
+*/
+static struct disk_entry* find_entry(char* url, unsigned long hash) {
+    struct disk_entry* e=disk.buckets[hash%DISK_BUCKETS];
+
+    while(e&&(e->hash!=hash||strcmp(e->url,url)))
+        e=e->hash_next;
+    return e;
+}
+
+/*
+	unlink_entry: take an entry out of the LRU list and the table.
+	Called with the lock held.
+*/
+static void unlink_entry(struct disk_entry* e) {
+    struct disk_entry** link=&disk.buckets[e->hash%DISK_BUCKETS];
+
+    while(*link!=e)
+        link=&(*link)->hash_next;
+    *link=e->hash_next;
+    if(e->prev)
+        e->prev->next=e->next;
+    else
+        disk.head=e->next;
+    if(e->next)
+        e->next->prev=e->prev;
+    else
+        disk.tail=e->prev;
+    disk.total_size-=e->size;
+}
+
+/*
+	push_front: put an entry at the front of the LRU list and in the
+	table. Called with the lock held.
+*/
+static void push_front(struct disk_entry* e) {
+    e->prev=NULL;
+    e->next=disk.head;
+    if(disk.head)
+        disk.head->prev=e;
+    else
+        disk.tail=e;
+    disk.head=e;
+    e->hash_next=disk.buckets[e->hash%DISK_BUCKETS];
+    disk.buckets[e->hash%DISK_BUCKETS]=e;
+    disk.total_size+=e->size;
+}
+
+/*
+	free_entry: remove the file of an entry and free it
+*/
+static void free_entry(struct disk_entry* e) {
+    unlink(e->path);
+    Free(e->url);
+    Free(e);
+}
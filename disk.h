@@ -0,0 +1,31 @@
+/************************************************************
+	disk.h
+	A disk-backed cache tier for large objects
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __DISK_H__
+#define __DISK_H__
+
+#include <stdbool.h>
+#include <time.h>
+
+/* default size budget of the disk tier, in megabytes */
+#define DEFAULT_DISK_CACHE_MB 256
+/* an object may take at most this part of the disk budget */
+#define DISK_OBJECT_SHARE 8
+/* buckets of the disk tier's url table */
+#define DISK_BUCKETS 1024
+
+int init_disk_cache(char* dir, long max_size);
+bool disk_cache_enabled(void);
+long disk_max_object(void);
+int disk_send(int clientfd, char* url, bool* keeps_alive);
+int disk_begin_fill(char* path);
+void disk_end_fill(int fd, char* path, char* url, long size,
+	bool keeps_alive, time_t expires, bool complete);
+void free_disk_cache(void);
+
+#endif /* __DISK_H__ */
@@ -0,0 +1,330 @@
+/************************************************************
+	dns.c
+	A caching, coalescing name resolver for the proxy
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+getaddrinfo blocks, and every miss used to call it. Here the answers
+are kept by "host:port" for DNS_TTL seconds (failures for
+DNS_NEGATIVE_TTL seconds, so a bad name does not cost a lookup per
+request). getaddrinfo does not report the TTL of the records, so a
+fixed one is used: short enough that a moved server is found again
+within a minute, long enough that a busy server costs one lookup a
+minute instead of one per miss. The negative TTL is shorter still, a
+name that fails for a moment (a resolver timeout, say) is tried again
+soon.
+
+When the answer is not known, the lookup is queued for a small pool
+of resolver threads and the caller is told through a callback, so an
+event loop never blocks on a name. Lookups of the same name while one
+is already running just wait for its answer: a burst of misses for a
+new host costs a single getaddrinfo. dns_lookup is the blocking form
+for the threaded servers.
+
+The lookups are done by the function given to init_dns, getaddrinfo
+for the proxy; the test passes its own, which counts the calls and
+answers without a network.
+
+************************************************************/
+#include <time.h>
+#include <stdbool.h>
+#include "cache.h"
+#include "dns.h"
+
+/*
+	Someone waiting for a lookup that is running
+*/
+struct dns_waiter {
+    dns_callback_t done;
+    void* arg;
+    struct dns_waiter* next;
+};
+
+/*
+	One name and its latest answer
+*/
+struct dns_entry {
+    char* key; // "host:port"
+    char* host;
+    char* port;
+    unsigned long hash;
+    Dns_result_t* result; // latest answer, NULL before the first one
+    time_t expires; // when result is too old to be used
+    bool resolving; // a resolver thread is looking it up
+    int family; // address family that connected last, AF_UNSPEC if none
+    struct dns_waiter* waiters; // who waits for the lookup
+    struct dns_entry* next; // next entry in the same bucket
+    struct dns_entry* job_next; // next entry waiting for a resolver
+};
+
+static struct dns_entry* entries[DNS_BUCKETS];
+static int nentries;
+static struct dns_entry *jobs_head, *jobs_tail; // lookups to run
+static sem_t dns_lock; // protects the entries and the job queue
+static sem_t jobs; // number of lookups in the job queue
+static dns_getaddrinfo_t dns_getaddrinfo; // runs the lookups
+
+static void* resolver_thread(void* vargp);
+static struct dns_entry* find_entry(char* host, char* port, bool create);
+static void drop_expired(time_t now);
+static void wake_up(void* arg, Dns_result_t* result);
+
+/* what dns_lookup waits on */
+struct dns_wait {
+    sem_t done;
+    Dns_result_t* result;
+};
+
+
+/*
+	init_dns: set up an empty name table and start the resolvers,
+	which look names up with resolve
+*/
+void init_dns(dns_getaddrinfo_t resolve) {
+    pthread_t tid;
+    int i;
+
+    dns_getaddrinfo=resolve;
+    Sem_init(&dns_lock, 0, 1);
+    Sem_init(&jobs, 0, 0);
+    for(i=0;i<DNS_RESOLVERS;i++)
+        Pthread_create(&tid, NULL, resolver_thread, NULL);
+}
+
+/*
+	dns_resolve: find the addresses of host and port.
+	When a fresh answer is known it is returned held, and done is not
+	called. Otherwise NULL is returned, and done is called later from
+	a resolver thread with the held answer.
+	Either way the caller must dns_release the answer.
+*/
+Dns_result_t* dns_resolve(char* host, char* port,
+	dns_callback_t done, void* arg) {
+    struct dns_entry* e;
+    struct dns_waiter* w;
+    Dns_result_t* result=NULL;
+
+    P(&dns_lock);
+    e=find_entry(host,port,true);
+    if(e->result&&time(NULL)<e->expires) {
+        result=e->result;
+        __atomic_fetch_add(&result->refcnt, 1, __ATOMIC_RELAXED);
+        V(&dns_lock);
+        return result;
+    }
+
+    w=Malloc(sizeof(struct dns_waiter));
+    w->done=done;
+    w->arg=arg;
+    w->next=e->waiters;
+    e->waiters=w;
+    if(!e->resolving) {
+        e->resolving=true;
+        e->job_next=NULL;
+        if(jobs_tail)
+            jobs_tail->job_next=e;
+        else
+            jobs_head=e;
+        jobs_tail=e;
+        V(&jobs);
+    }
+    V(&dns_lock);
+    return NULL;
+}
+
+/*
+	dns_lookup: find the addresses of host and port, waiting for the
+	lookup when the answer is not known. The caller must dns_release
+	the answer.
+*/
+Dns_result_t* dns_lookup(char* host, char* port) {
+    struct dns_wait wait;
+    Dns_result_t* result;
+
+    Sem_init(&wait.done, 0, 0);
+    result=dns_resolve(host,port,wake_up,&wait);
+    if(result==NULL) {
+        P(&wait.done);
+        result=wait.result;
+    }
+    sem_destroy(&wait.done);
+    return result;
+}
+
+/*
+	dns_release: drop a reference to an answer, the last one frees it
+*/
+void dns_release(Dns_result_t* result) {
+    if(__atomic_sub_fetch(&result->refcnt, 1, __ATOMIC_ACQ_REL)==0) {
+        if(result->addrs)
+            freeaddrinfo(result->addrs);
+        Free(result);
+    }
+}
+
+
+/*
+	dns_preferred_family: the address family that connected to host
+	and port last time, AF_UNSPEC when there is none
+*/
+int dns_preferred_family(char* host, char* port) {
+    struct dns_entry* e;
+    int family=AF_UNSPEC;
+
+    P(&dns_lock);
+    if((e=find_entry(host,port,false))!=NULL)
+        family=e->family;
+    V(&dns_lock);
+    return family;
+}
+
+/*
+	dns_remember_family: note the address family that connected to
+	host and port, it is tried first next time
+*/
+void dns_remember_family(char* host, char* port, int family) {
+    struct dns_entry* e;
+
+    P(&dns_lock);
+    if((e=find_entry(host,port,false))!=NULL)
+        e->family=family;
+    V(&dns_lock);
+}
+
+
+/*
+	resolver_thread: run the queued lookups, store each answer and
+	hand it to everyone waiting for it
+*/
+static void* resolver_thread(void* vargp) {
+    struct addrinfo hints;
+    struct dns_entry* e;
+    struct dns_waiter *w,*next;
+    Dns_result_t *result,*old;
+    time_t now;
+
+    Pthread_detach(pthread_self());
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;  /* Open a connection */
+    hints.ai_flags = AI_NUMERICSERV;  /* ... using a numeric port arg. */
+    hints.ai_flags |= AI_ADDRCONFIG;  /* Recommended for connections */
+
+    while(1) {
+        P(&jobs);
+        P(&dns_lock);
+        e=jobs_head;
+        jobs_head=e->job_next;
+        if(jobs_head==NULL)
+            jobs_tail=NULL;
+        V(&dns_lock);
+
+        // the entry stays while it is resolving, host and port too
+        result=Malloc(sizeof(Dns_result_t));
+        result->addrs=NULL;
+        result->error=dns_getaddrinfo(e->host, e->port, &hints,
+            &result->addrs);
+        if(result->error!=0) {
+            fprintf(stderr, "%s: %s\n", "Getaddrinfo error",
+                gai_strerror(result->error));
+            result->addrs=NULL;
+        }
+        result->refcnt=1; // the entry's reference
+
+        now=time(NULL);
+        P(&dns_lock);
+        old=e->result;
+        e->result=result;
+        e->expires=now+(result->error? DNS_NEGATIVE_TTL : DNS_TTL);
+        e->resolving=false;
+        w=e->waiters;
+        e->waiters=NULL;
+        for(next=w;next;next=next->next)
+            result->refcnt++;
+        V(&dns_lock);
+
+        if(old)
+            dns_release(old);
+        while(w) {
+            next=w->next;
+            w->done(w->arg,result);
+            Free(w);
+            w=next;
+        }
+    }
+    return NULL;
+}
+
+/*
+	find_entry: find the entry of host and port, create an empty one
+	when asked to. Called with dns_lock held.
+*/
+static struct dns_entry* find_entry(char* host, char* port, bool create) {
+    char key[MAXLINE*2];
+    unsigned long hash;
+    struct dns_entry* e;
+
+    snprintf(key,sizeof(key),"%s:%s",host,port);
+    hash=cache_hash(key);
+    for(e=entries[hash%DNS_BUCKETS];e;e=e->next) {
+        if(e->hash==hash&&!strcmp(e->key,key))
+            return e;
+    }
+    if(!create)
+        return NULL;
+    if(nentries>=DNS_MAX_ENTRIES)
+        drop_expired(time(NULL));
+
+    e=Calloc(1,sizeof(struct dns_entry));
+    e->key=Malloc(strlen(key)+1);
+    strcpy(e->key,key);
+    e->host=Malloc(strlen(host)+1);
+    strcpy(e->host,host);
+    e->port=Malloc(strlen(port)+1);
+    strcpy(e->port,port);
+    e->hash=hash;
+    e->family=AF_UNSPEC;
+    e->next=entries[hash%DNS_BUCKETS];
+    entries[hash%DNS_BUCKETS]=e;
+    nentries++;
+    return e;
+}
+
+/*
+	drop_expired: free the entries whose answer is too old and that
+	are not being looked up. The table can still grow past
+	DNS_MAX_ENTRIES when every name is fresh. Called with dns_lock
+	held.
+*/
+static void drop_expired(time_t now) {
+    struct dns_entry **link,*e;
+    int i;
+
+    for(i=0;i<DNS_BUCKETS;i++) {
+        link=&entries[i];
+        while((e=*link)!=NULL) {
+            if(e->resolving||now<e->expires) {
+                link=&e->next;
+                continue;
+            }
+            *link=e->next;
+            if(e->result)
+                dns_release(e->result);
+            Free(e->key);
+            Free(e->host);
+            Free(e->port);
+            Free(e);
+            nentries--;
+        }
+    }
+}
+
+/*
+	wake_up: the callback of dns_lookup, hands the answer to the
+	waiting thread
+*/
+static void wake_up(void* arg, Dns_result_t* result) {
+    struct dns_wait* wait=arg;
+
+    wait->result=result;
+    V(&wait->done);
+}
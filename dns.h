@@ -0,0 +1,52 @@
+/************************************************************
+	dns.h
+	A caching, coalescing name resolver for the proxy
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __DNS_H__
+#define __DNS_H__
+
+#include "csapp.h"
+
+/* resolver threads doing the getaddrinfo calls */
+#define DNS_RESOLVERS 4
+/* seconds an answer is used before it is looked up again; fixed,
+   getaddrinfo does not report the TTL of the records */
+#define DNS_TTL 60
+/* seconds a failed lookup is remembered */
+#define DNS_NEGATIVE_TTL 5
+/* buckets of the name table */
+#define DNS_BUCKETS 256
+/* names kept before expired ones are dropped */
+#define DNS_MAX_ENTRIES 1024
+
+/*
+	The answer of one lookup, shared by everyone who asked for it.
+	It is never changed, the last reference frees it.
+*/
+struct dns_result {
+    int refcnt;
+    int error; // 0, or the getaddrinfo error code
+    struct addrinfo* addrs; // NULL when error is set
+};
+typedef struct dns_result  Dns_result_t;
+
+/* called with a held result once a lookup finishes */
+typedef void (*dns_callback_t)(void* arg, Dns_result_t* result);
+
+/* runs one lookup, getaddrinfo or a stand-in for it */
+typedef int (*dns_getaddrinfo_t)(const char* host, const char* port,
+	const struct addrinfo* hints, struct addrinfo** addrs);
+
+void init_dns(dns_getaddrinfo_t resolve);
+Dns_result_t* dns_resolve(char* host, char* port,
+	dns_callback_t done, void* arg);
+Dns_result_t* dns_lookup(char* host, char* port);
+void dns_release(Dns_result_t* result);
+int dns_preferred_family(char* host, char* port);
+void dns_remember_family(char* host, char* port, int family);
+
+#endif /* __DNS_H__ */
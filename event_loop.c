@@ -0,0 +1,819 @@
+/************************************************************
+	event_loop.c
+	An event-driven server core for the proxy
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+One thread serves every connection with epoll and non-blocking
+sockets. In multi-reactor mode (run_reactors) several such threads
+run side by side, each with its own SO_REUSEPORT listening socket and
+its own epoll instance, so the kernel spreads new connections over
+them and they share nothing but the cache. Each connection is a state
+machine moved forward by readiness events:
+
+    READ_REQUEST   read the request line and headers from client
+    WRITE_HIT      write a cached response to client
+    RESOLVE_SERVER wait for a resolver thread to look up the server
+    CONNECT_SERVER wait for the non-blocking connect to the server
+    WRITE_REQUEST  write the rewritten request to server
+    RELAY_RESPONSE read the response from server, write it to client;
+                   while it is small it is read straight into its
+                   cache block
+
+The cache is used exactly as by the threaded server: a hit holds a
+reference to the block while writing it, and a response smaller than
+MAX_OBJECT_SIZE is inserted once the server closes the connection.
+
+Server names are looked up by the resolver threads of dns.c, which
+report the answer by writing the connection to a pipe the reactor
+watches, so the loop itself never blocks in getaddrinfo.
+
+************************************************************/
+#include <stdbool.h>
+#include <sys/epoll.h>
+#include "proxy.h"
+#include "event_loop.h"
+#include "affinity.h"
+#include "dns.h"
+#include "store.h"
+#include "http.h"
+#include "refresh.h"
+
+#define MAX_EVENTS 256
+#define RELAY_BUFSIZE 16384
+
+enum conn_state {
+    READ_REQUEST,
+    WRITE_HIT,
+    RESOLVE_SERVER,
+    CONNECT_SERVER,
+    WRITE_REQUEST,
+    RELAY_RESPONSE
+};
+
+struct conn;
+
+/*
+	One end of a connection registered in epoll, the event tells
+	which connection and which end is ready
+*/
+struct ev_handle {
+    int fd;
+    uint32_t events; // events we are interested in, 0 if not registered
+    struct conn* conn;
+};
+typedef struct ev_handle  Ev_handle_t;
+
+/*
+	The state of one client connection
+*/
+struct conn {
+    enum conn_state state;
+    Ev_handle_t client;
+    Ev_handle_t server;
+
+    char request[MAXLINE]; // request line and headers from client
+    size_t request_len;
+    char request_uri[MAXLINE];
+
+    Outvec_t server_out; // rewritten request for server, not written yet
+    struct addrinfo* addrs; // server addresses not tried yet
+    Dns_result_t* dns; // the held answer the addresses are from
+    int resolved_fd; // the reactor's pipe for the resolver's answer
+
+    Cache_t* hit; // the cached block being written, held
+    size_t hit_off;
+
+    char relay[RELAY_BUFSIZE]; // response read when it is not cached
+    char* relay_data; // response bytes not written to client
+    size_t relay_len, relay_off;
+    Cache_t* fill; // the response is read into it for the cache
+    bool cacheable; // false once the response grows too large
+};
+typedef struct conn  Conn_t;
+
+/* the epoll instance of the reactor running in this thread */
+static __thread int epfd;
+/* resolved connections come back to this thread through the pipe */
+static __thread int resolved_pipe[2];
+
+/* what a reactor thread needs to start */
+struct reactor_arg {
+    int listenfd;
+    int cpu; // cpu to pin to, -1 to let the scheduler decide
+};
+
+static void* reactor_thread(void* vargp);
+static int open_reuseport_listenfd(char* port);
+static void accept_clients(int listenfd);
+static void handle_event(Ev_handle_t* h, uint32_t events);
+static void read_request(Conn_t* c);
+static void start_request(Conn_t* c);
+static void dns_done(void* arg, Dns_result_t* result);
+static void take_resolved(void);
+static void resolved(Conn_t* c);
+static void connect_server(Conn_t* c);
+static void finish_connect(Conn_t* c);
+static void write_request(Conn_t* c);
+static void write_hit(Conn_t* c);
+static void relay_response(Conn_t* c);
+static int flush_relay(Conn_t* c);
+static char* fill_room(Conn_t* c, size_t* room);
+static void drop_fill(Conn_t* c);
+static void close_conn(Conn_t* c);
+static int set_interest(Ev_handle_t* h, uint32_t events);
+static int set_nonblocking(int fd);
+
+
+/*
+	run_event_loop: serve all clients from the calling thread,
+	never returns
+*/
+void run_event_loop(int listenfd) {
+    struct epoll_event events[MAX_EVENTS];
+    Ev_handle_t listen_handle,resolved_handle;
+    int i,n;
+
+    if((epfd=epoll_create1(0))<0)
+        unix_error("epoll_create1 error");
+    if(set_nonblocking(listenfd)<0)
+        unix_error("set listenfd nonblocking error");
+    if(pipe(resolved_pipe)<0||set_nonblocking(resolved_pipe[0])<0)
+        unix_error("resolved pipe error");
+
+    listen_handle.fd=listenfd;
+    listen_handle.events=0;
+    listen_handle.conn=NULL;
+    if(set_interest(&listen_handle,EPOLLIN)<0)
+        unix_error("epoll_ctl listenfd error");
+    resolved_handle.fd=resolved_pipe[0];
+    resolved_handle.events=0;
+    resolved_handle.conn=NULL;
+    if(set_interest(&resolved_handle,EPOLLIN)<0)
+        unix_error("epoll_ctl resolved pipe error");
+
+    printf("serving clients with an epoll event loop (listenfd %d)\n",
+        listenfd);
+    while(1) {
+        n=epoll_wait(epfd,events,MAX_EVENTS,-1);
+        if(n<0) {
+            if(errno==EINTR)
+                continue;
+            unix_error("epoll_wait error");
+        }
+        for(i=0;i<n;i++) {
+            Ev_handle_t* h=events[i].data.ptr;
+            if(h==&listen_handle)
+                accept_clients(listenfd);
+            else if(h==&resolved_handle)
+                take_resolved();
+            else
+                handle_event(h,events[i].events);
+        }
+    }
+}
+
+
+/*
+	run_reactors: serve all clients from nreactors event loop threads,
+	each accepting on its own SO_REUSEPORT socket bound to port;
+	reactor i is pinned to cpu i when pin_cpus is set.
+	never returns
+*/
+void run_reactors(char* port, int nreactors, int pin_cpus) {
+    pthread_t tids[MAX_REACTORS];
+    int i,rc;
+
+    for(i=0;i<nreactors;i++) {
+        struct reactor_arg* arg=Malloc(sizeof(struct reactor_arg));
+        if((arg->listenfd=open_reuseport_listenfd(port))<0)
+            unix_error("open_reuseport_listenfd error");
+        arg->cpu=pin_cpus? i : -1;
+        if((rc=pthread_create(&tids[i],NULL,reactor_thread,arg))!=0)
+            posix_error(rc,"pthread create error");
+    }
+    for(i=0;i<nreactors;i++)
+        Pthread_join(tids[i],NULL);
+}
+
+/*
+	reactor_thread: thread function of one reactor
+*/
+static void* reactor_thread(void* vargp) {
+    struct reactor_arg arg=*(struct reactor_arg*)vargp;
+    int rc;
+
+    Free(vargp);
+    if(arg.cpu>=0&&(rc=pin_to_cpu(arg.cpu))!=0)
+        fprintf(stderr, "%s: %s\n", "pin to cpu error", strerror(rc));
+    run_event_loop(arg.listenfd);
+    return NULL;
+}
+
+/*
+	open_reuseport_listenfd (modified from open_listenfd in CSAPP.C):
+	open a listening socket on port with SO_REUSEPORT set, so every
+	reactor can bind its own socket to the same port.
+	return -1 on error
+*/
+static int open_reuseport_listenfd(char* port) {
+    struct addrinfo hints, *listp, *p;
+    int listenfd=-1, optval=1, rc;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+    if ((rc = getaddrinfo(NULL, port, &hints, &listp)) != 0) {
+        fprintf(stderr, "%s: %s\n", "Getaddrinfo error", gai_strerror(rc));
+        return -1;
+    }
+
+    for (p = listp; p; p = p->ai_next) {
+        if ((listenfd = socket(p->ai_family, p->ai_socktype,
+            p->ai_protocol)) < 0) 
+            continue;
+        if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+                (const void *)&optval, sizeof(int)) == 0 &&
+            setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                (const void *)&optval, sizeof(int)) == 0 &&
+            bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        close(listenfd);
+    }
+
+    freeaddrinfo(listp);
+    if (!p)
+        return -1;
+    if (listen(listenfd, LISTENQ) < 0) {
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+
+/*
+	accept_clients: accept every pending connection and wait for
+	its request
+*/
+static void accept_clients(int listenfd) {
+    int clientfd;
+    Conn_t* c;
+
+    while((clientfd=accept(listenfd,NULL,NULL))>=0) {
+        if(set_nonblocking(clientfd)<0) {
+            close(clientfd);
+            continue;
+        }
+        c=calloc(1,sizeof(Conn_t));
+        if(c==NULL) {
+            fprintf(stderr, "%s: %s\n", "calloc error", strerror(errno));
+            close(clientfd);
+            continue;
+        }
+        c->state=READ_REQUEST;
+        c->client.fd=clientfd;
+        c->client.conn=c;
+        c->server.fd=-1;
+        c->server.conn=c;
+        c->resolved_fd=resolved_pipe[1];
+        c->cacheable=true;
+        if(set_interest(&c->client,EPOLLIN)<0) {
+            fprintf(stderr, "epoll_ctl error:%s\n",strerror(errno));
+            close_conn(c);
+        }
+    }
+    if(errno!=EAGAIN&&errno!=EWOULDBLOCK&&errno!=EINTR)
+        fprintf(stderr, "accept error:%s\n",strerror(errno));
+}
+
+
+/*
+	handle_event: move a connection forward after one of its ends
+	became ready. Errors and hangups are left to the read or write
+	that follows to report.
+*/
+static void handle_event(Ev_handle_t* h, uint32_t events) {
+    Conn_t* c=h->conn;
+
+    switch(c->state) {
+    case READ_REQUEST:
+        read_request(c);
+        break;
+    case WRITE_HIT:
+        write_hit(c);
+        break;
+    case RESOLVE_SERVER:
+        break; // no end is registered while resolving
+    case CONNECT_SERVER:
+        finish_connect(c);
+        break;
+    case WRITE_REQUEST:
+        write_request(c);
+        break;
+    case RELAY_RESPONSE:
+        if(h==&c->client) {
+            int rc=flush_relay(c);
+            if(rc==-1)
+                close_conn(c);
+            else if(rc==0)
+                relay_response(c);
+        }
+        else
+            relay_response(c);
+        break;
+    }
+}
+
+
+/*
+	read_request: read from client until the empty line that ends
+	the request headers
+*/
+static void read_request(Conn_t* c) {
+    ssize_t n;
+
+    while(1) {
+        if(c->request_len>=sizeof(c->request)-1) {
+            fprintf(stderr,"request headers too long\n");
+            close_conn(c);
+            return;
+        }
+        n=read(c->client.fd,c->request+c->request_len,
+            sizeof(c->request)-1-c->request_len);
+        if(n<0) {
+            if(errno==EINTR)
+                continue;
+            if(errno==EAGAIN||errno==EWOULDBLOCK)
+                return;
+            close_conn(c);
+            return;
+        }
+        if(n==0) {
+            // a client may connect and close without asking anything
+            if(c->request_len>0)
+                fprintf(stderr,"bad request line\n");
+            close_conn(c);
+            return;
+        }
+        c->request_len+=n;
+        c->request[c->request_len]='\0';
+        if(strstr(c->request,"\r\n\r\n")) {
+            start_request(c);
+            return;
+        }
+    }
+}
+
+
+/*
+	start_request: parse the request, serve it from the cache when
+	it's cached, otherwise rewrite it for server and start connecting
+*/
+static void start_request(Conn_t* c) {
+    char method[MAXLINE],version[MAXLINE],query[MAXLINE];
+    char host[MAXLINE],port[MAXLINE];
+    char *line,*end,next;
+    int seen=0,rc;
+    Dns_result_t* result;
+
+    line=c->request;
+    end=strstr(line,"\r\n");
+    *end='\0';
+    if(parse_request_line(line,method,c->request_uri,version)==-1) {
+        fprintf(stderr,"bad request line\n");
+        close_conn(c);
+        return;
+    }
+    if (strcasecmp(method, "GET")) {
+        clienterror(c->client.fd, method, "501", "Not Implemented",
+                    "proxy does not implement this method");
+        close_conn(c);
+        return;
+    }
+
+    printf("Receive request uri = %s\n",c->request_uri);
+    unsigned long hash=cache_hash(c->request_uri);
+    c->hit=lookup_shard(c->request_uri,hash,select_shard(hash,&cache));
+    if(c->hit&&!refresh_hit(c->hit,time(NULL))) {
+        // no longer fresh nor in its stale window, fetched again as the
+        // loop does not revalidate
+        release_cache_block(c->hit);
+        c->hit=NULL;
+    }
+    if(c->hit) {
+        printf("Cache Hit!!!!!!!\n");
+        c->state=WRITE_HIT;
+        if(set_interest(&c->client,EPOLLOUT)<0) {
+            close_conn(c);
+            return;
+        }
+        write_hit(c);
+        return;
+    }
+
+    printf("Cache Miss!!!!!!!\n");
+    if(parse_request_uri(c->request_uri,host,port,query)==-1) {
+        fprintf(stderr, "invalid request uri error = %s\n",strerror(errno));
+        close_conn(c);
+        return;
+    }
+
+    /* rewrite the request headers line by line; each line is passed
+       with its \r\n, the byte after it is set to '\0' meanwhile
+    */
+    outvec_init(&c->server_out);
+    if(outvec_printf(&c->server_out,"%s %s %s\r\n",method,query,
+        "HTTP/1.0")==-1) {
+        fprintf(stderr, "invalid request uri error\n");
+        close_conn(c);
+        return;
+    }
+    line=end+2;
+    while((end=strstr(line,"\r\n"))!=line) {
+        next=end[2];
+        end[2]='\0';
+        rc=rewrite_request_header(line,&c->server_out,&seen);
+        end[2]=next;
+        if(rc==-1) {
+            fprintf(stderr, "proxy read headers error\n");
+            close_conn(c);
+            return;
+        }
+        line=end+2;
+    }
+    if(finish_request_headers(&c->server_out,host,seen,0)==-1) {
+        fprintf(stderr, "proxy read headers error\n");
+        close_conn(c);
+        return;
+    }
+    // the response to a request with credentials is not shared
+    if(seen&SEEN_AUTHORIZATION)
+        c->cacheable=false;
+
+    // the client has nothing more to say until the response is sent
+    if(set_interest(&c->client,0)<0) {
+        close_conn(c);
+        return;
+    }
+
+    /* a known name is answered at once, otherwise dns_done brings
+       the answer back to this thread; it may set c->dns before
+       dns_resolve even returns, so c->dns is only set here on a hit
+    */
+    c->state=RESOLVE_SERVER;
+    if((result=dns_resolve(host,port,dns_done,c))!=NULL) {
+        c->dns=result;
+        resolved(c);
+    }
+}
+
+
+/*
+	dns_done: called by a resolver thread with the answer for a
+	connection, passes the connection back to its reactor
+*/
+static void dns_done(void* arg, Dns_result_t* result) {
+    Conn_t* c=arg;
+
+    c->dns=result;
+    // a pointer is less than PIPE_BUF, so the write is atomic
+    while(write(c->resolved_fd,&c,sizeof(c))<0) {
+        if(errno!=EINTR)
+            unix_error("resolved pipe write error");
+    }
+}
+
+/*
+	take_resolved: read the resolved connections from the pipe and
+	start connecting them
+*/
+static void take_resolved(void) {
+    Conn_t* done[MAX_EVENTS];
+    ssize_t n;
+    int i;
+
+    while(1) {
+        n=read(resolved_pipe[0],done,sizeof(done));
+        if(n<0&&errno==EINTR)
+            continue;
+        if(n<=0)
+            return;
+        for(i=0;i<n/(ssize_t)sizeof(Conn_t*);i++)
+            resolved(done[i]);
+    }
+}
+
+/*
+	resolved: the server's name is looked up, connect to it
+*/
+static void resolved(Conn_t* c) {
+    if(c->dns->error) {
+        close_conn(c);
+        return;
+    }
+    c->addrs=c->dns->addrs;
+    connect_server(c);
+}
+
+
+/*
+	connect_server: start a non-blocking connect to the next server
+	address, the connection is closed when none is left
+*/
+static void connect_server(Conn_t* c) {
+    struct addrinfo* p;
+
+    while((p=c->addrs)!=NULL) {
+        c->addrs=p->ai_next;
+        c->server.fd=socket(p->ai_family,p->ai_socktype|SOCK_NONBLOCK,
+            p->ai_protocol);
+        if(c->server.fd<0)
+            continue;
+        if(connect(c->server.fd,p->ai_addr,p->ai_addrlen)==0||
+            errno==EINPROGRESS) {
+            c->state=CONNECT_SERVER;
+            if(set_interest(&c->server,EPOLLOUT)<0)
+                break;
+            return;
+        }
+        close(c->server.fd);
+        c->server.fd=-1;
+    }
+    fprintf(stderr, "proxy cannot connect to server error:%s\n",
+        strerror(errno));
+    close_conn(c);
+}
+
+
+/*
+	finish_connect: the connect finished, send the request when it
+	succeeded, otherwise try the next address
+*/
+static void finish_connect(Conn_t* c) {
+    int err=0;
+    socklen_t len=sizeof(err);
+
+    if(getsockopt(c->server.fd,SOL_SOCKET,SO_ERROR,&err,&len)<0)
+        err=errno;
+    if(err!=0) {
+        set_interest(&c->server,0);
+        close(c->server.fd);
+        c->server.fd=-1;
+        connect_server(c);
+        return;
+    }
+    c->state=WRITE_REQUEST;
+    write_request(c);
+}
+
+
+/*
+	write_request: write the rewritten request to server, then wait
+	for the response
+*/
+static void write_request(Conn_t* c) {
+    ssize_t n;
+
+    while(c->server_out.len>0) {
+        n=outvec_write_some(c->server.fd,&c->server_out);
+        if(n<0) {
+            if(errno==EINTR)
+                continue;
+            if(errno==EAGAIN||errno==EWOULDBLOCK)
+                return;
+            fprintf(stderr, "proxy write to server error:%s\n",
+                strerror(errno));
+            close_conn(c);
+            return;
+        }
+    }
+    c->state=RELAY_RESPONSE;
+    if(set_interest(&c->server,EPOLLIN)<0)
+        close_conn(c);
+}
+
+
+/*
+	write_hit: write the cached response to client, close when done
+*/
+static void write_hit(Conn_t* c) {
+    ssize_t n;
+
+    while(c->hit_off<c->hit->response_size) {
+        n=write(c->client.fd,c->hit->response+c->hit_off,
+            c->hit->response_size-c->hit_off);
+        if(n<0) {
+            if(errno==EINTR)
+                continue;
+            if(errno==EAGAIN||errno==EWOULDBLOCK)
+                return;
+            fprintf(stderr, "write cached object to client error:%s\n"
+            	,strerror(errno));
+            break;
+        }
+        c->hit_off+=n;
+    }
+    close_conn(c);
+}
+
+
+/*
+	relay_response: read from server and write to client until server
+	closes; when client cannot take more, stop reading server until
+	the pending bytes are written
+*/
+static void relay_response(Conn_t* c) {
+    ssize_t n;
+    size_t room;
+    char* buf;
+    time_t now,expires;
+    long stale;
+    int rc;
+
+    while(1) {
+        // while the response can be cached it is read straight into
+        // its cache block
+        if((buf=fill_room(c,&room))==NULL) {
+            buf=c->relay;
+            room=RELAY_BUFSIZE;
+        }
+        n=read(c->server.fd,buf,room);
+        if(n<0) {
+            if(errno==EINTR)
+                continue;
+            if(errno==EAGAIN||errno==EWOULDBLOCK)
+                return;
+            fprintf(stderr, "proxy read from server error:%s\n",
+                strerror(errno));
+            close_conn(c);
+            return;
+        }
+        if(n==0)
+            break;
+        if(buf==c->relay)
+            drop_fill(c); // not cached after all
+        else
+            c->fill->response_size+=n;
+        c->relay_data=buf;
+        c->relay_len=n;
+        c->relay_off=0;
+        rc=flush_relay(c);
+        if(rc==-1) {
+            close_conn(c);
+            return;
+        }
+        if(rc==1)
+            return; // wait until client can take more
+    }
+
+    // server closed, the whole response is relayed, its headers tell
+    // if it may be cached and for how long
+    now=time(NULL);
+    if(c->fill&&c->fill->response_size>0&&
+        (expires=stored_response_expires(c->fill->response,
+        c->fill->response_size,now,&stale))!=0) {
+        set_freshness(c->fill,now,expires,stale);
+        if(store_enabled())
+            store_insert(c->request_uri,c->fill->response,
+                c->fill->response_size,false);
+        insert_to_shard(c->fill,select_shard(c->fill->hash,&cache));
+        c->fill=NULL;
+    }
+    close_conn(c);
+}
+
+
+/*
+	flush_relay: write the pending response bytes to client.
+	return 0 when all are written, server is read again
+	return 1 when client cannot take more, we wait for it
+	return -1 when write to client error, the caller closes it
+*/
+static int flush_relay(Conn_t* c) {
+    ssize_t n;
+
+    while(c->relay_off<c->relay_len) {
+        n=write(c->client.fd,c->relay_data+c->relay_off,
+            c->relay_len-c->relay_off);
+        if(n<0) {
+            if(errno==EINTR)
+                continue;
+            if(errno==EAGAIN||errno==EWOULDBLOCK) {
+                if(set_interest(&c->server,0)<0||
+                    set_interest(&c->client,EPOLLOUT)<0)
+                    return -1;
+                return 1;
+            }
+            fprintf(stderr, "write response object to client error:%s\n",
+                strerror(errno));
+            return -1;
+        }
+        c->relay_off+=n;
+    }
+    if(set_interest(&c->client,0)<0||set_interest(&c->server,EPOLLIN)<0)
+        return -1;
+    return 0;
+}
+
+
+/*
+	fill_room: where the next bytes of the response go in its cache
+	block, made at the first call and grown to twice its size when it
+	is full, at most to MAX_OBJECT_SIZE-1 bytes; *room is set to how
+	many fit
+	return NULL when the response is not cached, or the block cannot
+	grow any more, also when the slab arena has no room for it
+*/
+static char* fill_room(Conn_t* c, size_t* room) {
+    Cache_t* b=c->fill;
+    size_t capacity;
+
+    if(!c->cacheable)
+        return NULL;
+    if(b==NULL)
+        b=new_cache_block(c->request_uri,CACHE_FILL_CHUNK);
+    else if(b->response_size==b->capacity) {
+        if(b->capacity>=MAX_OBJECT_SIZE-1)
+            return NULL;
+        capacity=b->capacity*2<MAX_OBJECT_SIZE? b->capacity*2
+            : MAX_OBJECT_SIZE-1;
+        b=grow_cache_block(b,capacity);
+    }
+    if(b==NULL)
+        return NULL;
+    c->fill=b;
+    *room=b->capacity-b->response_size;
+    return b->response+b->response_size;
+}
+
+/*
+	drop_fill: the response is not cached after all (too large, or no
+	room in the slab arena), free its block
+*/
+static void drop_fill(Conn_t* c) {
+    c->cacheable=false;
+    if(c->fill) {
+        free_cache_block(c->fill);
+        c->fill=NULL;
+    }
+}
+
+
+/*
+	close_conn: close both ends of a connection and free it
+*/
+static void close_conn(Conn_t* c) {
+    if(c->client.events)
+        epoll_ctl(epfd,EPOLL_CTL_DEL,c->client.fd,NULL);
+    if(c->server.fd>=0&&c->server.events)
+        epoll_ctl(epfd,EPOLL_CTL_DEL,c->server.fd,NULL);
+    if(close(c->client.fd)<0)
+        fprintf(stderr, "%s: %s\n", "close clientfd error", strerror(errno));
+    if(c->server.fd>=0)
+        close(c->server.fd);
+    if(c->dns)
+        dns_release(c->dns);
+    if(c->hit)
+        release_cache_block(c->hit);
+    if(c->fill)
+        free_cache_block(c->fill);
+    free(c);
+}
+
+
+/*
+	set_interest: change the events we wait for on one end,
+	0 removes it from epoll
+	return -1 on error
+*/
+static int set_interest(Ev_handle_t* h, uint32_t events) {
+    struct epoll_event ev;
+    int op;
+
+    if(h->events==events)
+        return 0;
+    if(events==0)
+        op=EPOLL_CTL_DEL;
+    else if(h->events==0)
+        op=EPOLL_CTL_ADD;
+    else
+        op=EPOLL_CTL_MOD;
+    ev.events=events;
+    ev.data.ptr=h;
+    if(epoll_ctl(epfd,op,h->fd,&ev)<0)
+        return -1;
+    h->events=events;
+    return 0;
+}
+
+
+/*
+	set_nonblocking: put a descriptor in non-blocking mode
+*/
+static int set_nonblocking(int fd) {
+    int flags=fcntl(fd,F_GETFL,0);
+    if(flags<0)
+        return -1;
+    return fcntl(fd,F_SETFL,flags|O_NONBLOCK);
+}
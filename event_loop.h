@@ -0,0 +1,18 @@
+/************************************************************
+	event_loop.h
+	An event-driven server core for the proxy
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+/* upper bound on the number of reactor threads */
+#define MAX_REACTORS 256
+
+void run_event_loop(int listenfd);
+void run_reactors(char* port, int nreactors, int pin_cpus);
+
+#endif /* __EVENT_LOOP_H__ */
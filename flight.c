@@ -0,0 +1,199 @@
+/************************************************************
+	flight.c
+	Coalescing of concurrent misses on the same url
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+When a popular url is not cached yet, every client asking for it at
+the same time used to miss, fetch it from the server and insert its
+own copy. Now the first one to miss joins the table of fetches in
+flight as the leader and fetches it; the ones that miss while it is
+in flight wait for it.
+
+The waiters do not wait for the whole download. Once the leader knows
+the response fits a cache block (its headers give a Content-Length
+small enough) it streams the block: the response is read into it and
+each read publishes a new high-water mark, which the waiters tail,
+writing each new part to their clients as it arrives. The block is
+given its full size before it is streamed, so it never moves while it
+is tailed. Other responses are handed over when they are complete.
+
+The leader finishes its flight as soon as it knows the result: the
+block once it is inserted, or none as soon as the response turns out
+not to be cacheable (too large, chunked, or an error), so waiters do
+not sit through a download they cannot use and fetch it themselves.
+A waiter that already sent part of a streamed response that failed
+closes its client, as the leader's client is. A finished flight
+leaves the table at once; the last client to leave it frees it.
+
+************************************************************/
+#include "csapp.h"
+#include "flight.h"
+
+static Flight_t* flights[FLIGHT_BUCKETS];
+static sem_t flight_lock; // protects the table and the refcnt of flights
+
+static void unlink_flight(Flight_t* f);
+
+
+/*
+	init_flights: set up an empty table of fetches in flight
+*/
+void init_flights(void) {
+    Sem_init(&flight_lock, 0, 1);
+}
+
+/*
+	flight_join: join the fetch of url in flight, or start one.
+	*leader is set when this client starts it and must fetch the url
+	and flight_finish; otherwise it waits with flight_wait.
+	Either way it calls flight_leave when done.
+*/
+Flight_t* flight_join(char* url, unsigned long hash, bool* leader) {
+    Flight_t* f;
+
+    P(&flight_lock);
+    for(f=flights[hash%FLIGHT_BUCKETS];f;f=f->next) {
+        if(f->hash==hash&&!strcmp(f->url,url)) {
+            f->refcnt++;
+            V(&flight_lock);
+            *leader=false;
+            return f;
+        }
+    }
+    f=Calloc(1,sizeof(Flight_t));
+    f->url=Malloc(strlen(url)+1);
+    strcpy(f->url,url);
+    f->hash=hash;
+    f->refcnt=1;
+    pthread_mutex_init(&f->lock,NULL);
+    pthread_cond_init(&f->progress,NULL);
+    f->next=flights[hash%FLIGHT_BUCKETS];
+    flights[hash%FLIGHT_BUCKETS]=f;
+    V(&flight_lock);
+    *leader=true;
+    return f;
+}
+
+/*
+	flight_stream: the leader lets the waiters tail block while it is
+	filled, the flight takes a reference to it. The block must not
+	move from now on. Only the first call counts, so the leader calls
+	it again before inserting a block that was not streamed.
+*/
+void flight_stream(Flight_t* f, Cache_t* block) {
+    pthread_mutex_lock(&f->lock);
+    if(!f->done&&f->block==NULL) {
+        hold_cache_block(block);
+        f->block=block;
+        pthread_cond_broadcast(&f->progress);
+    }
+    pthread_mutex_unlock(&f->lock);
+}
+
+/*
+	flight_progress: the first filled bytes of the streamed block can
+	be sent
+*/
+void flight_progress(Flight_t* f, size_t filled) {
+    pthread_mutex_lock(&f->lock);
+    f->filled=filled;
+    pthread_cond_broadcast(&f->progress);
+    pthread_mutex_unlock(&f->lock);
+}
+
+/*
+	flight_finish: the leader ends the flight, cached tells if the
+	whole response is in the streamed block. Only the first call
+	counts, so the leader may call it again on its way out.
+*/
+void flight_finish(Flight_t* f, bool cached) {
+    pthread_mutex_lock(&f->lock);
+    if(f->done) {
+        pthread_mutex_unlock(&f->lock);
+        return;
+    }
+    f->done=true;
+    f->cached=cached&&f->block!=NULL;
+    if(f->cached)
+        f->filled=f->block->response_size;
+    pthread_cond_broadcast(&f->progress);
+    pthread_mutex_unlock(&f->lock);
+
+    P(&flight_lock);
+    unlink_flight(f);
+    V(&flight_lock);
+}
+
+/*
+	flight_wait: wait for the leader to stream its block or finish
+	return the block, held for the caller, to be sent with flight_tail
+	return NULL when there is none and the caller has to fetch the url
+	itself
+*/
+Cache_t* flight_wait(Flight_t* f) {
+    Cache_t* block=NULL;
+
+    pthread_mutex_lock(&f->lock);
+    while(!f->done&&f->block==NULL)
+        pthread_cond_wait(&f->progress,&f->lock);
+    if(f->block&&(!f->done||f->cached)) {
+        block=f->block;
+        hold_cache_block(block);
+    }
+    pthread_mutex_unlock(&f->lock);
+    return block;
+}
+
+/*
+	flight_tail: wait until more than the first sent bytes of the
+	block can be sent
+	return how many can be sent
+	return sent when the whole response was sent
+	return -1 when the fetch failed, the response will not be complete
+*/
+long flight_tail(Flight_t* f, size_t sent) {
+    long n;
+
+    pthread_mutex_lock(&f->lock);
+    while(f->filled<=sent&&!f->done)
+        pthread_cond_wait(&f->progress,&f->lock);
+    if(f->filled>sent)
+        n=f->filled;
+    else
+        n=f->cached? (long)sent : -1;
+    pthread_mutex_unlock(&f->lock);
+    return n;
+}
+
+/*
+	flight_leave: done with a flight, the last one to leave frees it
+*/
+void flight_leave(Flight_t* f) {
+    int refcnt;
+
+    P(&flight_lock);
+    refcnt=--f->refcnt;
+    V(&flight_lock);
+    if(refcnt>0)
+        return;
+    if(f->block)
+        release_cache_block(f->block);
+    pthread_cond_destroy(&f->progress);
+    pthread_mutex_destroy(&f->lock);
+    Free(f->url);
+    Free(f);
+}
+
+
+/*
+	unlink_flight: take a flight out of the table, new misses start a
+	new one. Called with flight_lock held.
+*/
+static void unlink_flight(Flight_t* f) {
+    Flight_t** link=&flights[f->hash%FLIGHT_BUCKETS];
+
+    while(*link!=f)
+        link=&(*link)->next;
+    *link=f->next;
+}
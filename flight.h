@@ -0,0 +1,46 @@
+/************************************************************
+	flight.h
+	Coalescing of concurrent misses on the same url
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __FLIGHT_H__
+#define __FLIGHT_H__
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "cache.h"
+
+/* buckets of the table of fetches in flight */
+#define FLIGHT_BUCKETS 256
+
+/*
+	One fetch in flight: the first client to miss a url fetches it,
+	the others tail the block it fills
+*/
+struct flight {
+    char* url;
+    unsigned long hash;
+    int refcnt; // the fetching client and the waiting ones
+    bool done; // the fetch has its result, it left the table
+    bool cached; // when done, the whole response is in block
+    Cache_t* block; // the block being filled, held, NULL until streamed
+    size_t filled; // bytes of block's response ready to be sent
+    pthread_mutex_t lock; // protects the fields above but refcnt
+    pthread_cond_t progress; // broadcast when filled or done change
+    struct flight* next; // next fetch in the same bucket
+};
+typedef struct flight  Flight_t;
+
+void init_flights(void);
+Flight_t* flight_join(char* url, unsigned long hash, bool* leader);
+void flight_stream(Flight_t* f, Cache_t* block);
+void flight_progress(Flight_t* f, size_t filled);
+void flight_finish(Flight_t* f, bool cached);
+Cache_t* flight_wait(Flight_t* f);
+long flight_tail(Flight_t* f, size_t sent);
+void flight_leave(Flight_t* f);
+
+#endif /* __FLIGHT_H__ */
@@ -0,0 +1,488 @@
+/************************************************************
+	http.c
+	Parsing of HTTP/1.x response headers for the proxy
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+#include "csapp.h"
+#include "http.h"
+
+static bool header_is(char* line, const char* name, char** value);
+static long directive_value(char* value, const char* name);
+static void copy_validator(char* to, char* value);
+static time_t parse_http_date(char* value);
+static int parse_header_lines(char* p, char* end, Http_response_t* resp);
+static bool is_empty_line(char* p, char* nl);
+static bool head_has_header(char* p, char* end, char* name, size_t len);
+static bool header_is_kept(char* name, size_t len);
+
+/* headers a 304 does not update: they frame the cached body and the
+   connection it came on, not what the 304 is about */
+static const char* kept_headers[]={"Content-Length","Transfer-Encoding",
+    "Connection","Keep-Alive","Proxy-Connection","Trailer","Upgrade",
+    NULL};
+
+/*
+	parse_status_line: get the version and status code from the status
+	line of a response and reset the rest of resp.
+	return -1 when it is not a HTTP/1.x status line
+	return 0 when success
+*/
+int parse_status_line(char* line, Http_response_t* resp) {
+    resp->status=0;
+    resp->content_length=-1;
+    resp->chunked=false;
+    resp->conn_close=false;
+    resp->conn_keep_alive=false;
+    resp->no_store=false;
+    resp->no_cache=false;
+    resp->max_age=-1;
+    resp->shared_max_age=false;
+    resp->must_revalidate=false;
+    resp->stale_while_revalidate=-1;
+    resp->date=-1;
+    resp->expires=-1;
+    resp->age=0;
+    resp->set_cookie=false;
+    resp->vary=false;
+    resp->etag[0]='\0';
+    resp->last_modified[0]='\0';
+    if(sscanf(line,"HTTP/1.%d %d",&resp->version_minor,&resp->status)!=2)
+        return -1;
+    return 0;
+}
+
+/*
+	parse_response_header: record what one header line says about the
+	framing of the body, the connection and caching
+*/
+void parse_response_header(char* line, Http_response_t* resp) {
+    char* value;
+    long n;
+
+    if(header_is(line,"Content-Length",&value))
+        resp->content_length=strtol(value,NULL,10);
+    else if(header_is(line,"Transfer-Encoding",&value))
+        resp->chunked=header_has_token(value,"chunked");
+    else if(header_is(line,"Connection",&value)) {
+        if(header_has_token(value,"close"))
+            resp->conn_close=true;
+        if(header_has_token(value,"keep-alive"))
+            resp->conn_keep_alive=true;
+    }
+    else if(header_is(line,"Cache-Control",&value)) {
+        // a shared cache must not keep private responses either
+        if(header_has_token(value,"no-store")||
+            header_has_token(value,"private"))
+            resp->no_store=true;
+        if(header_has_token(value,"no-cache"))
+            resp->no_cache=true;
+        if(header_has_token(value,"must-revalidate")||
+            header_has_token(value,"proxy-revalidate"))
+            resp->must_revalidate=true;
+        if((n=directive_value(value,"stale-while-revalidate"))>=0)
+            resp->stale_while_revalidate=n;
+        if((n=directive_value(value,"s-maxage"))>=0) {
+            resp->max_age=n;
+            resp->shared_max_age=true;
+        }
+        else if((n=directive_value(value,"max-age"))>=0&&
+            !resp->shared_max_age)
+            resp->max_age=n;
+    }
+    else if(header_is(line,"Expires",&value)) {
+        // a value that is not a date means already expired
+        if((resp->expires=parse_http_date(value))<0)
+            resp->expires=0;
+    }
+    else if(header_is(line,"Date",&value))
+        resp->date=parse_http_date(value);
+    else if(header_is(line,"Age",&value))
+        resp->age=strtol(value,NULL,10);
+    else if(header_is(line,"Set-Cookie",&value))
+        resp->set_cookie=true;
+    else if(header_is(line,"Vary",&value))
+        resp->vary=true;
+    else if(header_is(line,"ETag",&value))
+        copy_validator(resp->etag,value);
+    else if(header_is(line,"Last-Modified",&value))
+        copy_validator(resp->last_modified,value);
+}
+
+/*
+	parse_response_head: parse the status line and headers at the start
+	of a whole response kept by a cache
+	return -1 when it does not start with a HTTP/1.x status line and
+	complete headers
+	return 0 when success
+*/
+int parse_response_head(char* response, size_t size, Http_response_t* resp) {
+    char line[MAXLINE];
+    char* end=response+size;
+    char* nl;
+    size_t len;
+
+    if((nl=memchr(response,'\n',size))==NULL||
+        (len=nl-response+1)>=MAXLINE)
+        return -1;
+    memcpy(line,response,len);
+    line[len]='\0';
+    if(parse_status_line(line,resp)==-1)
+        return -1;
+    return parse_header_lines(nl+1,end,resp);
+}
+
+/*
+	merge_response_head: a 304 answer to a revalidation updates what the
+	cached response said, resp holds that and the 304's headers in
+	response are added over it
+*/
+void merge_response_head(char* response, size_t size, Http_response_t* resp) {
+    char* nl;
+
+    if((nl=memchr(response,'\n',size))!=NULL)
+        parse_header_lines(nl+1,response+size,resp);
+}
+
+/*
+	update_response_head: write to out the response a cache keeps once
+	a 304 answer (head, head_size bytes) to the revalidation of the
+	cached one (response, size bytes) updates it: the cached status
+	line and body, with the headers the 304 sends in place of the
+	cached ones of the same names, but for kept_headers. The cached
+	Age is dropped, the response was just validated.
+	return the size of the new response
+	return -1 when either head is incomplete or the new response
+	does not fit in capacity bytes
+*/
+long update_response_head(char* response, size_t size, char* head,
+	size_t head_size, char* out, size_t capacity) {
+    char *p,*nl,*colon,*end=response+size,*head_end=head+head_size;
+    char* body=NULL;
+    size_t len,used=0;
+    bool complete=false;
+
+    if((nl=memchr(response,'\n',size))==NULL||
+        (p=memchr(head,'\n',head_size))==NULL)
+        return -1;
+    head=p+1;
+    // the status line, then the cached headers the 304 leaves alone
+    for(p=response;p<end&&(nl=memchr(p,'\n',end-p))!=NULL;p=nl+1) {
+        len=nl-p+1;
+        if(p>response&&is_empty_line(p,nl)) {
+            body=p;
+            break;
+        }
+        colon=memchr(p,':',len);
+        if(p>response&&colon&&((colon-p==3&&!strncasecmp(p,"Age",3))||
+            (!header_is_kept(p,colon-p)&&
+            head_has_header(head,head_end,p,colon-p))))
+            continue;
+        if(used+len>capacity)
+            return -1;
+        memcpy(out+used,p,len);
+        used+=len;
+    }
+    if(body==NULL)
+        return -1;
+    // the 304's headers, up to its empty line
+    for(p=head;p<head_end&&(nl=memchr(p,'\n',head_end-p))!=NULL;
+        p=nl+1) {
+        len=nl-p+1;
+        if((complete=is_empty_line(p,nl)))
+            break;
+        colon=memchr(p,':',len);
+        if(colon==NULL||header_is_kept(p,colon-p))
+            continue;
+        if(used+len>capacity)
+            return -1;
+        memcpy(out+used,p,len);
+        used+=len;
+    }
+    if(!complete)
+        return -1;
+    // the empty line and the body
+    if(used+(end-body)>capacity)
+        return -1;
+    memcpy(out+used,body,end-body);
+    return used+(end-body);
+}
+
+/*
+	response_is_cacheable: whether a shared cache may keep a response.
+	Only the status codes that are cacheable by default are kept, and
+	never a response that is private to one client (no-store, private,
+	Set-Cookie) or that depends on request headers (Vary), as the cache
+	is keyed by url only. One that is stale at once can only be kept
+	when it can be revalidated.
+*/
+bool response_is_cacheable(Http_response_t* resp, time_t now) {
+    switch(resp->status) {
+    case 200: case 203: case 204: case 300: case 301: case 308:
+    case 404: case 405: case 410: case 414: case 501:
+        break;
+    default:
+        return false;
+    }
+    if(resp->no_store||resp->set_cookie||resp->vary)
+        return false;
+    if(resp->etag[0]||resp->last_modified[0])
+        return true;
+    return response_expires(resp,now)>now;
+}
+
+/*
+	response_expires: when a response received (or last revalidated)
+	no later than now stops being fresh. Its freshness lifetime comes
+	from s-maxage or max-age, else from Expires, else from a tenth of
+	the time since it was last modified, else HTTP_DEFAULT_FRESHNESS;
+	its age so far (the Age header or the time since its Date, which
+	is larger) is taken off.
+*/
+time_t response_expires(Http_response_t* resp, time_t now) {
+    time_t date=resp->date>=0? resp->date : now;
+    time_t modified;
+    long lifetime,age;
+
+    if(resp->no_cache)
+        return now;
+    if(resp->max_age>=0)
+        lifetime=resp->max_age;
+    else if(resp->expires>=0)
+        lifetime=resp->expires-date;
+    else if((modified=parse_http_date(resp->last_modified))>=0&&
+        modified<=date) {
+        lifetime=(date-modified)/10;
+        if(lifetime>HTTP_HEURISTIC_MAX)
+            lifetime=HTTP_HEURISTIC_MAX;
+    }
+    else
+        lifetime=HTTP_DEFAULT_FRESHNESS;
+    age=now>date? now-date : 0;
+    if(resp->age>age)
+        age=resp->age;
+    return now+lifetime-age;
+}
+
+/*
+	response_stale_window: how many seconds after it expires the
+	response may still be sent while it is revalidated
+	return 0 when it must be revalidated first
+	return -1 when the response does not say, the cache decides
+*/
+long response_stale_window(Http_response_t* resp) {
+    if(resp->no_cache||resp->must_revalidate)
+        return 0;
+    return resp->stale_while_revalidate;
+}
+
+/*
+	stored_response_expires: when a whole response kept by a cache
+	stops being fresh, from its own headers; *stale is set to its
+	response_stale_window
+	return 0 when it may not be cached at all
+*/
+time_t stored_response_expires(char* response, size_t size, time_t now,
+	long* stale) {
+    Http_response_t resp;
+
+    if(parse_response_head(response,size,&resp)==-1||
+        !response_is_cacheable(&resp,now))
+        return 0;
+    *stale=response_stale_window(&resp);
+    return response_expires(&resp,now);
+}
+
+/*
+	response_has_body: 1xx, 204 and 304 responses never have a body
+*/
+bool response_has_body(Http_response_t* resp) {
+    return !(resp->status/100==1||resp->status==204||resp->status==304);
+}
+
+/*
+	response_is_delimited: whether the end of the body is known without
+	the server closing the connection
+*/
+bool response_is_delimited(Http_response_t* resp) {
+    return !response_has_body(resp)||resp->chunked||resp->content_length>=0;
+}
+
+/*
+	response_keeps_alive: whether the server lets the connection be
+	used for another request after this response
+*/
+bool response_keeps_alive(Http_response_t* resp) {
+    if(!response_is_delimited(resp)||resp->conn_close)
+        return false;
+    return resp->version_minor>=1||resp->conn_keep_alive;
+}
+
+
+/*
+	header_is: whether line is the header name (case insensitive),
+	and if so where its value starts
+*/
+static bool header_is(char* line, const char* name, char** value) {
+    size_t len=strlen(name);
+
+    if(strncasecmp(line,name,len)||line[len]!=':')
+        return false;
+    *value=line+len+1;
+    while(**value==' '||**value=='\t')
+        (*value)++;
+    return true;
+}
+
+/*
+	directive_value: the number given to directive name in a comma
+	separated header value (name=number)
+	return -1 when there is none
+*/
+static long directive_value(char* value, const char* name) {
+    size_t len=strlen(name);
+    char* p=value;
+    char* end;
+    long n;
+
+    while(*p) {
+        while(*p==' '||*p=='\t'||*p==',')
+            p++;
+        if(!strncasecmp(p,name,len)&&p[len]=='=') {
+            p+=len+1;
+            if(*p=='"')
+                p++;
+            n=strtol(p,&end,10);
+            return end==p||n<0? -1 : n;
+        }
+        while(*p&&*p!=',')
+            p++;
+    }
+    return -1;
+}
+
+/*
+	copy_validator: keep a header value without the line end, a value
+	too long to keep is dropped
+*/
+static void copy_validator(char* to, char* value) {
+    size_t len=strcspn(value,"\r\n");
+
+    if(len>=HTTP_VALIDATOR_MAX)
+        len=0;
+    memcpy(to,value,len);
+    to[len]='\0';
+}
+
+/*
+	parse_http_date: the time of a HTTP-date such as
+	"Sun, 06 Nov 1994 08:49:37 GMT" (the older formats are not read)
+	return -1 when it is not one
+*/
+static time_t parse_http_date(char* value) {
+    static const char* months="JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    char* p;
+    int day,mon,year,h,m,sec;
+    long days;
+
+    if(sscanf(value,"%*[^,], %d %3s %d %d:%d:%d",&day,month,&year,
+        &h,&m,&sec)!=6)
+        return -1;
+    if(strlen(month)!=3||(p=strstr(months,month))==NULL||(p-months)%3)
+        return -1;
+    mon=(p-months)/3+1;
+    // days since 1970-01-01 of the civil date, March based years
+    year-=mon<=2;
+    days=(long)(year/400)*146097;
+    year%=400;
+    days+=year*365+year/4-year/100+
+        (153*(mon>2? mon-3 : mon+9)+2)/5+day-1-719468;
+    return (time_t)days*86400+h*3600+m*60+sec;
+}
+
+/*
+	parse_header_lines: parse the header lines from p up to the empty
+	line that ends them, at most up to end
+	return -1 when the headers do not end before end
+	return 0 when success
+*/
+static int parse_header_lines(char* p, char* end, Http_response_t* resp) {
+    char line[MAXLINE];
+    char* nl;
+    size_t len;
+
+    while(p<end&&(nl=memchr(p,'\n',end-p))!=NULL) {
+        len=nl-p+1;
+        if(len<=2&&(len==1||*p=='\r'))
+            return 0; // the empty line
+        if(len<MAXLINE) {
+            memcpy(line,p,len);
+            line[len]='\0';
+            parse_response_header(line,resp);
+        }
+        p=nl+1;
+    }
+    return -1;
+}
+
+/*
+	is_empty_line: whether the line from p to its newline nl is the
+	empty line that ends the headers
+*/
+static bool is_empty_line(char* p, char* nl) {
+    return nl==p||(nl==p+1&&*p=='\r');
+}
+
+/*
+	head_has_header: whether the header lines from p to end (up to
+	the empty line) have one named by the len bytes of name
+*/
+static bool head_has_header(char* p, char* end, char* name, size_t len) {
+    char* nl;
+
+    for(;p<end&&(nl=memchr(p,'\n',end-p))!=NULL;p=nl+1) {
+        if(is_empty_line(p,nl))
+            break;
+        if((size_t)(nl-p)>len&&p[len]==':'&&!strncasecmp(p,name,len))
+            return true;
+    }
+    return false;
+}
+
+/*
+	header_is_kept: whether the header named by the len bytes of name
+	is one of kept_headers
+*/
+static bool header_is_kept(char* name, size_t len) {
+    int i;
+
+    for(i=0;kept_headers[i];i++) {
+        if(strlen(kept_headers[i])==len&&
+            !strncasecmp(name,kept_headers[i],len))
+            return true;
+    }
+    return false;
+}
+
+/*
+	header_has_token: whether a comma separated header value has token
+	(case insensitive)
+*/
+bool header_has_token(char* value, const char* token) {
+    size_t len=strlen(token);
+    char* p=value;
+
+    while(*p) {
+        while(*p==' '||*p=='\t'||*p==',')
+            p++;
+        if(!strncasecmp(p,token,len)&&
+            (p[len]=='\0'||p[len]==','||p[len]==' '||p[len]=='\t'||
+             p[len]=='\r'||p[len]==';'||p[len]=='='))
+            return true;
+        while(*p&&*p!=',')
+            p++;
+    }
+    return false;
+}
@@ -0,0 +1,69 @@
+/************************************************************
+	http.h
+	Parsing of HTTP/1.x response headers for the proxy
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/* longest validator (ETag or Last-Modified value) that is kept */
+#define HTTP_VALIDATOR_MAX 256
+/* a response with no freshness information but its Last-Modified is
+   fresh for a tenth of its age, at most this many seconds */
+#define HTTP_HEURISTIC_MAX (24*3600)
+/* a response with no freshness information at all is fresh this long */
+#define HTTP_DEFAULT_FRESHNESS 300
+
+/*
+	What the proxy needs to know about a response from its headers:
+	how the body is framed, whether the connection stays open, and
+	whether and how long the response may be cached
+*/
+struct http_response {
+    int version_minor; // 0 for HTTP/1.0, 1 for HTTP/1.1
+    int status; // status code
+    long content_length; // -1 when there is no Content-Length
+    bool chunked; // Transfer-Encoding: chunked
+    bool conn_close; // Connection: close
+    bool conn_keep_alive; // Connection: keep-alive
+    bool no_store; // Cache-Control: no-store or private
+    bool no_cache; // Cache-Control: no-cache, revalidated at every use
+    long max_age; // Cache-Control: s-maxage or max-age, -1 if none
+    bool shared_max_age; // max_age is s-maxage, max-age does not win
+    bool must_revalidate; // must-revalidate or proxy-revalidate
+    long stale_while_revalidate; // Cache-Control: stale-while-revalidate,
+                                 // -1 if none
+    time_t date; // Date, -1 if none
+    time_t expires; // Expires, -1 if none, 0 if not a date (expired)
+    long age; // Age, 0 if none
+    bool set_cookie; // Set-Cookie, the response is for one client
+    bool vary; // Vary, the cache only knows responses by url
+    char etag[HTTP_VALIDATOR_MAX]; // ETag, empty if none
+    char last_modified[HTTP_VALIDATOR_MAX]; // Last-Modified, or empty
+};
+typedef struct http_response  Http_response_t;
+
+int parse_status_line(char* line, Http_response_t* resp);
+void parse_response_header(char* line, Http_response_t* resp);
+bool response_has_body(Http_response_t* resp);
+bool response_is_delimited(Http_response_t* resp);
+bool response_keeps_alive(Http_response_t* resp);
+bool header_has_token(char* value, const char* token);
+int parse_response_head(char* response, size_t size, Http_response_t* resp);
+void merge_response_head(char* response, size_t size, Http_response_t* resp);
+long update_response_head(char* response, size_t size, char* head,
+	size_t head_size, char* out, size_t capacity);
+bool response_is_cacheable(Http_response_t* resp, time_t now);
+time_t response_expires(Http_response_t* resp, time_t now);
+long response_stale_window(Http_response_t* resp);
+time_t stored_response_expires(char* response, size_t size, time_t now,
+	long* stale);
+
+#endif /* __HTTP_H__ */
@@ -0,0 +1,194 @@
+/************************************************************
+	outvec.c
+	Build an output from pieces and write it with one writev
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+The rewritten request, error pages and cached responses used to be
+put together with strcat or written piece by piece, each piece its own
+write. Here the pieces are collected as an iovec and go out with one
+writev: constant strings are not copied at all, and the rest is copied
+once, appended to the store without scanning what is already there.
+
+Every writev is counted, send SIGUSR1 to print the counters.
+
+************************************************************/
+#include <stdarg.h>
+#include "outvec.h"
+
+/* counters of all outputs, updated with atomic adds */
+static struct {
+    long writes; // writev calls
+    long segments; // segments written
+    long bytes; // bytes written
+} stats;
+
+static int add_segment(Outvec_t* ov, void* base, size_t len);
+static void count_write(int nsegs, ssize_t n);
+
+
+/*
+	outvec_init: start an empty output
+*/
+void outvec_init(Outvec_t* ov) {
+    ov->first=0;
+    ov->nsegs=0;
+    ov->len=0;
+    ov->used=0;
+}
+
+/*
+	outvec_ref: add a piece that is not copied, it must stay valid
+	until the output is written
+	return -1 when the output is full
+*/
+int outvec_ref(Outvec_t* ov, const void* base, size_t len) {
+    return add_segment(ov,(void*)base,len);
+}
+
+/*
+	outvec_copy: add a copy of a piece
+	return -1 when the output is full
+*/
+int outvec_copy(Outvec_t* ov, const void* base, size_t len) {
+    char* dst=ov->store+ov->used;
+    struct iovec* last;
+
+    if(ov->used+len>OUTVEC_STORE)
+        return -1;
+    memcpy(dst,base,len);
+    ov->used+=len;
+    // right after the last copy, so it grows the same segment
+    last=&ov->iov[ov->nsegs>0? ov->nsegs-1 : 0];
+    if(ov->nsegs>ov->first&&(char*)last->iov_base+last->iov_len==dst) {
+        last->iov_len+=len;
+        ov->len+=len;
+        return 0;
+    }
+    if(add_segment(ov,dst,len)==-1) {
+        ov->used-=len;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+	outvec_str: add a copy of a string
+	return -1 when the output is full
+*/
+int outvec_str(Outvec_t* ov, const char* str) {
+    return outvec_copy(ov,str,strlen(str));
+}
+
+/*
+	outvec_printf: add formatted text, copied
+	return -1 when the output is full
+*/
+int outvec_printf(Outvec_t* ov, const char* fmt, ...) {
+    char buf[MAXLINE];
+    va_list ap;
+    int n;
+
+    va_start(ap,fmt);
+    n=vsnprintf(buf,sizeof(buf),fmt,ap);
+    va_end(ap);
+    if(n<0||n>=(int)sizeof(buf))
+        return -1;
+    return outvec_copy(ov,buf,n);
+}
+
+/*
+	outvec_write: write the whole output to a blocking descriptor,
+	with one writev unless it is cut short. The output is left as it
+	was, so it can be written again.
+	return -1 on error
+*/
+int outvec_write(int fd, Outvec_t* ov) {
+    struct iovec iov[OUTVEC_SEGS];
+    int first=0,nsegs=ov->nsegs-ov->first;
+    size_t left=ov->len;
+    ssize_t n;
+
+    memcpy(iov,ov->iov+ov->first,nsegs*sizeof(struct iovec));
+    while(left>0) {
+        if((n=writev(fd,iov+first,nsegs-first))<0) {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        count_write(nsegs-first,n);
+        left-=n;
+        // skip what was written
+        while(n>0&&(size_t)n>=iov[first].iov_len)
+            n-=iov[first++].iov_len;
+        if(n>0) {
+            iov[first].iov_base=(char*)iov[first].iov_base+n;
+            iov[first].iov_len-=n;
+        }
+    }
+    return 0;
+}
+
+/*
+	outvec_write_some: one writev of what is left of the output, for
+	a non-blocking descriptor; what was written is taken off the front
+	return the bytes written, -1 on error (EAGAIN when it would block)
+*/
+ssize_t outvec_write_some(int fd, Outvec_t* ov) {
+    ssize_t n,done;
+
+    if(ov->len==0)
+        return 0;
+    if((n=writev(fd,ov->iov+ov->first,ov->nsegs-ov->first))<0)
+        return -1;
+    count_write(ov->nsegs-ov->first,n);
+    done=n;
+    ov->len-=n;
+    while(n>0&&(size_t)n>=ov->iov[ov->first].iov_len)
+        n-=ov->iov[ov->first++].iov_len;
+    if(n>0) {
+        ov->iov[ov->first].iov_base=(char*)ov->iov[ov->first].iov_base+n;
+        ov->iov[ov->first].iov_len-=n;
+    }
+    return done;
+}
+
+/*
+	print_outvec_stats: print the write counters, only uses the
+	async-signal-safe sio functions
+*/
+void print_outvec_stats(void) {
+    sio_puts("outvec: writev=");
+    sio_putl(__atomic_load_n(&stats.writes,__ATOMIC_RELAXED));
+    sio_puts(" segments=");
+    sio_putl(__atomic_load_n(&stats.segments,__ATOMIC_RELAXED));
+    sio_puts(" bytes=");
+    sio_putl(__atomic_load_n(&stats.bytes,__ATOMIC_RELAXED));
+    sio_puts("\n");
+}
+
+
+/*
+	add_segment: add a segment at the end
+	return -1 when there is no segment left
+*/
+static int add_segment(Outvec_t* ov, void* base, size_t len) {
+    if(len==0)
+        return 0;
+    if(ov->nsegs>=OUTVEC_SEGS)
+        return -1;
+    ov->iov[ov->nsegs].iov_base=base;
+    ov->iov[ov->nsegs].iov_len=len;
+    ov->nsegs++;
+    ov->len+=len;
+    return 0;
+}
+
+/*
+	count_write: count one writev of nsegs segments that wrote n bytes
+*/
+static void count_write(int nsegs, ssize_t n) {
+    __atomic_fetch_add(&stats.writes,1,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.segments,nsegs,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.bytes,n,__ATOMIC_RELAXED);
+}
@@ -0,0 +1,44 @@
+/************************************************************
+	outvec.h
+	Build an output from pieces and write it with one writev
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __OUTVEC_H__
+#define __OUTVEC_H__
+
+#include <sys/uio.h>
+#include "csapp.h"
+
+/* pieces in one output */
+#define OUTVEC_SEGS 64
+/* bytes one output can copy in */
+#define OUTVEC_STORE MAXLINE
+
+/*
+	An output as a list of pieces: constant strings are pointed to,
+	everything else is copied into store (pieces copied one after the
+	other share a segment)
+*/
+struct outvec {
+    struct iovec iov[OUTVEC_SEGS];
+    int first; // first segment not written yet
+    int nsegs; // segments in use
+    size_t len; // bytes not written yet
+    char store[OUTVEC_STORE];
+    size_t used; // bytes of store in use
+};
+typedef struct outvec  Outvec_t;
+
+void outvec_init(Outvec_t* ov);
+int outvec_ref(Outvec_t* ov, const void* base, size_t len);
+int outvec_copy(Outvec_t* ov, const void* base, size_t len);
+int outvec_str(Outvec_t* ov, const char* str);
+int outvec_printf(Outvec_t* ov, const char* fmt, ...);
+int outvec_write(int fd, Outvec_t* ov);
+ssize_t outvec_write_some(int fd, Outvec_t* ov);
+void print_outvec_stats(void);
+
+#endif /* __OUTVEC_H__ */
@@ -0,0 +1,499 @@
+/************************************************************
+	pool.c
+	A bounded pool of worker threads for the proxy
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+A fixed number of workers is started once. The main thread accepts
+connections and puts the descriptors in a bounded queue, the workers
+take them out and serve them with serve_client. It is the sbuf
+package from CS:APP, except the buffer itself is a lock-free
+multi-producer multi-consumer ring (sequence numbered cells), so
+the only synchronization left is the two counting semaphores that
+let an empty queue put workers to sleep and a full queue stop the
+acceptor.
+
+The work-stealing pool (run_stealing_pool) has no shared queue at
+all: every worker accepts connections itself into its own deque
+(Chase-Lev), serves them from the bottom, and when it runs out it
+steals from the top of another worker's deque. A worker stuck on a
+long download thus never holds up the connections it accepted.
+
+Queue depth and the time connections wait in the queue are counted,
+send SIGUSR1 to print them (the handler of proxy.c prints them with
+the other counters).
+
+************************************************************/
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include "proxy.h"
+#include "pool.h"
+#include "slab.h"
+
+/*
+	One cell of the ring. A cell at position pos is free for the
+	producer when seq==pos and holds an item for the consumer when
+	seq==pos+1.
+*/
+struct ring_cell {
+    unsigned long seq;
+    int fd; // accepted client descriptor
+    long enqueue_ns; // when it was queued, for the wait time
+};
+
+/*
+	The connection queue
+*/
+struct conn_queue {
+    struct ring_cell* cells;
+    unsigned long mask; // number of cells - 1 (power of two)
+    unsigned long enqueue_pos __attribute__((aligned(64)));
+    unsigned long dequeue_pos __attribute__((aligned(64)));
+    sem_t slots; // free slots, the acceptor waits on it
+    sem_t items; // queued connections, the workers wait on it
+};
+
+/*
+	A worker's deque of connections for the work-stealing pool. Only
+	its owner pushes and takes at the bottom, other workers steal at
+	the top.
+*/
+struct conn_deque {
+    long top __attribute__((aligned(64)));
+    long bottom __attribute__((aligned(64)));
+    int fds[DEQUE_SIZE];
+    long enqueue_ns[DEQUE_SIZE];
+};
+
+/*
+	Counters of the pool, updated with atomic operations
+*/
+struct pool_stats {
+    long queued; // connections put in the queue
+    long served; // connections taken out by a worker
+    long rejected; // answered with 503 because the queue was full
+    long dropped; // closed because the queue was full
+    long max_depth; // the deepest the queue has been
+    long total_wait_ns; // sum of the time spent in the queue
+    long max_wait_ns; // the longest time spent in the queue
+    long stolen; // connections served by a worker that did not accept them
+};
+
+static struct conn_queue queue;
+static struct pool_stats stats;
+static bool pool_running; // a pool serves the clients
+
+static struct conn_deque* deques;
+static int ndeques;
+static int steal_listenfd;
+
+static void queue_init(struct conn_queue* q, int depth);
+static void queue_put(struct conn_queue* q, int fd);
+static int queue_take(struct conn_queue* q, long* waited_ns);
+static void* worker_thread(void* vargp);
+static void* stealing_worker_thread(void* vargp);
+static int deque_push(struct conn_deque* d, int fd);
+static int deque_take(struct conn_deque* d, long* waited_ns);
+static int deque_steal(struct conn_deque* d, long* waited_ns);
+static void count_served(long waited_ns);
+static long now_ns(void);
+static void update_max(long* max, long value);
+
+
+/*
+	run_thread_pool: start nworkers workers and feed them accepted
+	connections through a queue of queue_depth slots. When the queue
+	is full the connection is handled according to policy.
+	never returns
+*/
+void run_thread_pool(int listenfd, int nworkers, int queue_depth,
+	Overload_policy_t policy) {
+    pthread_t tid;
+    struct sockaddr_storage clientaddr;
+    socklen_t clientlen;
+    int i,rc,clientfd;
+
+    queue_init(&queue,queue_depth);
+    pool_running=true;
+    for(i=0;i<nworkers;i++) {
+        if((rc=pthread_create(&tid,NULL,worker_thread,NULL))!=0)
+            posix_error(rc,"pthread create error");
+    }
+    printf("serving clients with %d workers, queue depth %lu\n",
+        nworkers,queue.mask+1);
+
+    while(1) {
+        clientlen=sizeof(clientaddr);
+        clientfd=accept(listenfd,(SA *)&clientaddr,&clientlen);
+        if(clientfd<0) {
+            fprintf(stderr, "accept error:%s\n",strerror(errno));
+            continue;
+        }
+
+        if(policy==OVERLOAD_BLOCK) {
+            P(&queue.slots);
+        }
+        else if(sem_trywait(&queue.slots)<0) {
+            if(policy==OVERLOAD_REJECT) {
+                __atomic_fetch_add(&stats.rejected,1,__ATOMIC_RELAXED);
+                clienterror(clientfd, "proxy", "503", "Service Unavailable",
+                    "proxy is too busy to serve the request now");
+            }
+            else {
+                __atomic_fetch_add(&stats.dropped,1,__ATOMIC_RELAXED);
+            }
+            if(close(clientfd)<0)
+                fprintf(stderr, "%s: %s\n", "close clientfd error",
+                    strerror(errno));
+            continue;
+        }
+        queue_put(&queue,clientfd);
+    }
+}
+
+
+/*
+	worker_thread: take connections from the queue and serve them
+*/
+static void* worker_thread(void* vargp) {
+    int clientfd;
+    long waited;
+
+    Pthread_detach(pthread_self());
+    while(1) {
+        clientfd=queue_take(&queue,&waited);
+        count_served(waited);
+
+        serve_client(clientfd);
+        if (close(clientfd)<0) {
+            fprintf(stderr, "%s: %s\n", "close clientfd error",
+                strerror(errno));
+        }
+    }
+    return NULL;
+}
+
+
+/*
+	run_stealing_pool: start nworkers workers that accept, queue and
+	steal connections by themselves, see stealing_worker_thread.
+	never returns
+*/
+void run_stealing_pool(int listenfd, int nworkers) {
+    pthread_t tid;
+    int i,rc,flags;
+
+    flags=fcntl(listenfd,F_GETFL,0);
+    if(flags<0||fcntl(listenfd,F_SETFL,flags|O_NONBLOCK)<0)
+        unix_error("set listenfd nonblocking error");
+    steal_listenfd=listenfd;
+    ndeques=nworkers;
+    deques=Calloc(nworkers,sizeof(struct conn_deque));
+    pool_running=true;
+    for(i=0;i<nworkers;i++) {
+        if((rc=pthread_create(&tid,NULL,stealing_worker_thread,
+            &deques[i]))!=0)
+            posix_error(rc,"pthread create error");
+    }
+    printf("serving clients with %d work-stealing workers\n",nworkers);
+    while(1)
+        pause();
+}
+
+/*
+	stealing_worker_thread: a worker of the work-stealing pool.
+	It moves every pending connection it can fit from the listening
+	socket into its own deque, then serves the newest one. With an
+	empty deque it tries to steal the oldest connection of another
+	worker, starting from a random one, and when there is nothing to
+	steal either it sleeps until a connection arrives (or a short
+	timeout, to look for work to steal again).
+*/
+static void* stealing_worker_thread(void* vargp) {
+    struct conn_deque* own=vargp;
+    struct pollfd pfd;
+    unsigned int seed=(unsigned int)(own-deques)*2654435761u;
+    int clientfd,i;
+    long waited;
+
+    Pthread_detach(pthread_self());
+    pfd.fd=steal_listenfd;
+    pfd.events=POLLIN;
+    while(1) {
+        // accept a batch of connections into our own deque
+        while(__atomic_load_n(&own->bottom,__ATOMIC_RELAXED)
+            -__atomic_load_n(&own->top,__ATOMIC_ACQUIRE)<DEQUE_SIZE) {
+            clientfd=accept(steal_listenfd,NULL,NULL);
+            if(clientfd<0)
+                break;
+            if(deque_push(own,clientfd)<0) {
+                close(clientfd);
+                break;
+            }
+        }
+
+        clientfd=deque_take(own,&waited);
+        if(clientfd<0) {
+            int start=rand_r(&seed)%ndeques;
+            for(i=0;i<ndeques&&clientfd<0;i++) {
+                struct conn_deque* victim=&deques[(start+i)%ndeques];
+                if(victim!=own)
+                    clientfd=deque_steal(victim,&waited);
+            }
+            if(clientfd>=0)
+                __atomic_fetch_add(&stats.stolen,1,__ATOMIC_RELAXED);
+        }
+        if(clientfd<0) {
+            poll(&pfd,1,10);
+            continue;
+        }
+
+        count_served(waited);
+        serve_client(clientfd);
+        if (close(clientfd)<0) {
+            fprintf(stderr, "%s: %s\n", "close clientfd error",
+                strerror(errno));
+        }
+    }
+    return NULL;
+}
+
+
+/*
+	print_pool_stats: print the pool counters, nothing when no pool
+	serves the clients. Only uses the async-signal-safe sio functions
+	so a signal handler can call it
+*/
+void print_pool_stats(void) {
+    long queued=__atomic_load_n(&stats.queued,__ATOMIC_RELAXED);
+    long served=__atomic_load_n(&stats.served,__ATOMIC_RELAXED);
+    long wait=__atomic_load_n(&stats.total_wait_ns,__ATOMIC_RELAXED);
+
+    if(!pool_running)
+        return;
+
+    sio_puts("pool: queued=");
+    sio_putl(queued);
+    sio_puts(" served=");
+    sio_putl(served);
+    sio_puts(" depth=");
+    sio_putl(queued-served);
+    sio_puts(" max_depth=");
+    sio_putl(__atomic_load_n(&stats.max_depth,__ATOMIC_RELAXED));
+    sio_puts(" rejected=");
+    sio_putl(__atomic_load_n(&stats.rejected,__ATOMIC_RELAXED));
+    sio_puts(" dropped=");
+    sio_putl(__atomic_load_n(&stats.dropped,__ATOMIC_RELAXED));
+    sio_puts(" avg_wait_us=");
+    sio_putl(served? wait/served/1000 : 0);
+    sio_puts(" max_wait_us=");
+    sio_putl(__atomic_load_n(&stats.max_wait_ns,__ATOMIC_RELAXED)/1000);
+    sio_puts(" stolen=");
+    sio_putl(__atomic_load_n(&stats.stolen,__ATOMIC_RELAXED));
+    sio_puts("\n");
+}
+
+
+/*
+	queue_init: set up an empty queue with at least depth slots
+*/
+static void queue_init(struct conn_queue* q, int depth) {
+    unsigned long n=1,i;
+
+    while(n<(unsigned long)depth)
+        n<<=1;
+    q->cells=Calloc(n,sizeof(struct ring_cell));
+    for(i=0;i<n;i++)
+        q->cells[i].seq=i;
+    q->mask=n-1;
+    q->enqueue_pos=0;
+    q->dequeue_pos=0;
+    Sem_init(&q->slots,0,depth);
+    Sem_init(&q->items,0,0);
+}
+
+/*
+	queue_put: put a descriptor in the queue, the caller already
+	owns a free slot
+*/
+static void queue_put(struct conn_queue* q, int fd) {
+    struct ring_cell* cell;
+    unsigned long pos,seq;
+    long diff,depth;
+
+    pos=__atomic_load_n(&q->enqueue_pos,__ATOMIC_RELAXED);
+    while(1) {
+        cell=&q->cells[pos&q->mask];
+        seq=__atomic_load_n(&cell->seq,__ATOMIC_ACQUIRE);
+        diff=(long)seq-(long)pos;
+        if(diff==0) {
+            if(__atomic_compare_exchange_n(&q->enqueue_pos,&pos,pos+1,
+                1,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+                break;
+        }
+        else if(diff<0) {
+            /* a worker took the slot but has not released the cell */
+            sched_yield();
+            pos=__atomic_load_n(&q->enqueue_pos,__ATOMIC_RELAXED);
+        }
+        else {
+            pos=__atomic_load_n(&q->enqueue_pos,__ATOMIC_RELAXED);
+        }
+    }
+    cell->fd=fd;
+    cell->enqueue_ns=now_ns();
+    __atomic_store_n(&cell->seq,pos+1,__ATOMIC_RELEASE);
+
+    depth=__atomic_add_fetch(&stats.queued,1,__ATOMIC_RELAXED)
+        -__atomic_load_n(&stats.served,__ATOMIC_RELAXED);
+    update_max(&stats.max_depth,depth);
+    V(&q->items);
+}
+
+/*
+	queue_take: wait for a descriptor and take it out of the queue,
+	also return how long it waited in the queue
+*/
+static int queue_take(struct conn_queue* q, long* waited_ns) {
+    struct ring_cell* cell;
+    unsigned long pos,seq;
+    long diff;
+    int fd;
+
+    P(&q->items);
+    pos=__atomic_load_n(&q->dequeue_pos,__ATOMIC_RELAXED);
+    while(1) {
+        cell=&q->cells[pos&q->mask];
+        seq=__atomic_load_n(&cell->seq,__ATOMIC_ACQUIRE);
+        diff=(long)seq-(long)(pos+1);
+        if(diff==0) {
+            if(__atomic_compare_exchange_n(&q->dequeue_pos,&pos,pos+1,
+                1,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+                break;
+        }
+        else if(diff<0) {
+            /* an acceptor took this cell but has not filled it yet */
+            sched_yield();
+            pos=__atomic_load_n(&q->dequeue_pos,__ATOMIC_RELAXED);
+        }
+        else {
+            pos=__atomic_load_n(&q->dequeue_pos,__ATOMIC_RELAXED);
+        }
+    }
+    fd=cell->fd;
+    *waited_ns=now_ns()-cell->enqueue_ns;
+    __atomic_store_n(&cell->seq,pos+q->mask+1,__ATOMIC_RELEASE);
+
+    V(&q->slots);
+    return fd;
+}
+
+
+/*
+	deque_push: the owner puts a descriptor at the bottom of its deque
+	return -1 when the deque is full
+*/
+static int deque_push(struct conn_deque* d, int fd) {
+    long b=__atomic_load_n(&d->bottom,__ATOMIC_RELAXED);
+    long t=__atomic_load_n(&d->top,__ATOMIC_ACQUIRE);
+    long depth;
+
+    if(b-t>=DEQUE_SIZE)
+        return -1;
+    __atomic_store_n(&d->fds[b%DEQUE_SIZE],fd,__ATOMIC_RELAXED);
+    __atomic_store_n(&d->enqueue_ns[b%DEQUE_SIZE],now_ns(),__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom,b+1,__ATOMIC_RELAXED);
+
+    depth=__atomic_add_fetch(&stats.queued,1,__ATOMIC_RELAXED)
+        -__atomic_load_n(&stats.served,__ATOMIC_RELAXED);
+    update_max(&stats.max_depth,depth);
+    return 0;
+}
+
+/*
+	deque_take: the owner takes the newest descriptor from the bottom
+	of its deque
+	return -1 when the deque is empty
+*/
+static int deque_take(struct conn_deque* d, long* waited_ns) {
+    long b=__atomic_load_n(&d->bottom,__ATOMIC_RELAXED)-1;
+    long t;
+    int fd=-1;
+
+    __atomic_store_n(&d->bottom,b,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t=__atomic_load_n(&d->top,__ATOMIC_RELAXED);
+    if(t<=b) {
+        fd=__atomic_load_n(&d->fds[b%DEQUE_SIZE],__ATOMIC_RELAXED);
+        *waited_ns=now_ns()-
+            __atomic_load_n(&d->enqueue_ns[b%DEQUE_SIZE],__ATOMIC_RELAXED);
+        if(t==b) {
+            // the last one, race the thieves for it
+            if(!__atomic_compare_exchange_n(&d->top,&t,t+1,0,
+                __ATOMIC_SEQ_CST,__ATOMIC_RELAXED))
+                fd=-1;
+            __atomic_store_n(&d->bottom,b+1,__ATOMIC_RELAXED);
+        }
+    }
+    else {
+        __atomic_store_n(&d->bottom,b+1,__ATOMIC_RELAXED);
+    }
+    return fd;
+}
+
+/*
+	deque_steal: another worker takes the oldest descriptor from the
+	top of a deque
+	return -1 when the deque is empty or another thief won
+*/
+static int deque_steal(struct conn_deque* d, long* waited_ns) {
+    long t=__atomic_load_n(&d->top,__ATOMIC_ACQUIRE);
+    long b;
+    int fd;
+    long enqueued;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b=__atomic_load_n(&d->bottom,__ATOMIC_ACQUIRE);
+    if(t>=b)
+        return -1;
+    fd=__atomic_load_n(&d->fds[t%DEQUE_SIZE],__ATOMIC_RELAXED);
+    enqueued=__atomic_load_n(&d->enqueue_ns[t%DEQUE_SIZE],__ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&d->top,&t,t+1,0,
+        __ATOMIC_SEQ_CST,__ATOMIC_RELAXED))
+        return -1;
+    *waited_ns=now_ns()-enqueued;
+    return fd;
+}
+
+
+/*
+	count_served: count a connection taken out of a queue and its
+	wait time
+*/
+static void count_served(long waited_ns) {
+    __atomic_fetch_add(&stats.served,1,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.total_wait_ns,waited_ns,__ATOMIC_RELAXED);
+    update_max(&stats.max_wait_ns,waited_ns);
+}
+
+
+/*
+	now_ns: monotonic time in nanoseconds
+*/
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000000L+ts.tv_nsec;
+}
+
+/*
+	update_max: raise *max to value if it is larger
+*/
+static void update_max(long* max, long value) {
+    long old=__atomic_load_n(max,__ATOMIC_RELAXED);
+    while(value>old&&!__atomic_compare_exchange_n(max,&old,value,
+        1,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+        ;
+}
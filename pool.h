@@ -0,0 +1,34 @@
+/************************************************************
+	pool.h
+	A bounded pool of worker threads for the proxy
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+/* upper bounds on the pool size and the queue depth */
+#define MAX_WORKERS 1024
+#define MAX_QUEUE_DEPTH 65536
+
+/*
+	What the acceptor does with a connection when the queue is full
+*/
+enum overload_policy {
+    OVERLOAD_BLOCK, // stop accepting until a worker frees a slot
+    OVERLOAD_REJECT, // answer 503 Service Unavailable and close
+    OVERLOAD_DROP // close it without an answer
+};
+typedef enum overload_policy  Overload_policy_t;
+
+/* slots in each worker's deque in the work-stealing pool */
+#define DEQUE_SIZE 64
+
+void run_thread_pool(int listenfd, int nworkers, int queue_depth,
+	Overload_policy_t policy);
+void run_stealing_pool(int listenfd, int nworkers);
+void print_pool_stats(void);
+
+#endif /* __POOL_H__ */
@@ -3,59 +3,122 @@ proxy.c
 
 A http caching web proxy handles HTTP/1.0 GET requests.
 
-The proxy will start a thread for each client's request.
-I implement the cache as a singly linked list that approximates
-a least-recently-used (LRU) eviction policy.
+By default the proxy will start a thread for each client's request,
+with -e it serves all clients from one thread driven by epoll events,
+and with -r N from N such threads with their own listening sockets
+(see event_loop.c). With -p N a fixed pool of N worker threads is fed
+accepted connections through a bounded queue, with -w N the N workers
+accept into their own deques and steal from each other (see pool.c).
+I implement the cache as a doubly linked list kept in
+least-recently-used (LRU) order, with a hash index over the list, so a
+lookup, a hit and an eviction all take constant time. The cache is
+split into shards by the hash of the url, each shard has its own lock
+and its own part of MAX_CACHE_SIZE, so requests on different cores
+rarely wait for each other. Cache hits take no lock at all: a hit
+takes a reference to the immutable block and writes it to the client
+outside the cache, evicted blocks are freed by their last reference.
+With -E slru or -E tinylfu the shards keep segmented LRU lists
+instead, and tinylfu only admits urls asked for more often than the
+blocks they would evict (see cache.c).
 
 For each request, the proxy will search the cache to see if there
 is corresponding response cached. If find corresponding response in
 cache, just use it for response, otherwise, connect to server and get
 response,send back to client also save the response in cache when necessary
 
+The threaded servers keep a client's connection open for its next
+request when the client asks for it (HTTP/1.1 or keep-alive) and the
+response says where it ends. They also keep the connections to the
+servers open when the servers allow it, a later miss for the same
+server reuses one from the pool in upstream.c. Server names are
+looked up once per DNS_TTL by the resolver threads in dns.c. With -d,
+objects too large for the memory cache are kept in files and sent
+with sendfile (see disk.c). With -c, the cached objects are also kept
+in a memory-mapped file that a restarted proxy serves from at once
+(see store.c).
+
 
 *************************************************************/
 #include <stdio.h>
 #include "csapp.h"
 #include <stdbool.h>
 #include "cache.h"
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+#include "proxy.h"
+#include "event_loop.h"
+#include "pool.h"
+#include "http.h"
+#include "upstream.h"
+#include "dns.h"
+#include "connect.h"
+#include "zerocopy.h"
+#include "disk.h"
+#include "store.h"
+#include "slab.h"
+#include "flight.h"
+#include "refresh.h"
+/* every shard must still be able to hold one object */
+#define DEFAULT_CACHE_SHARDS 8
+#define MAX_SHARDS (MAX_CACHE_SIZE/MAX_OBJECT_SIZE)
+#define DEFAULT_QUEUE_DEPTH 256
+/* seconds a kept-alive client may stay idle between requests */
+#define CLIENT_IDLE_TIMEOUT 5
 
 /*Length of different strings*/
 #define len_of_HOST 4
 #define len_of_User_Agent 10
 #define len_of_Connection 10
 #define len_of_Proxy_Connection 16
+#define len_of_Keep_Alive 10
+#define len_of_Authorization 13
+#define len_of_Cache_Control 13
+#define len_of_Pragma 6
+#define len_of_If_None_Match 13
+#define len_of_If_Modified_Since 17
 
 
 static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
 static const char *connection_hdr = "Connection: close\r\n";
 static const char *proxy_connection_hdr = "Proxy-Connection: close\r\n";
+static const char *keep_alive_hdr = "Connection: keep-alive\r\n";
 
 
 //****************global variables************
 
-Cache_t * cache;
-size_t total_cache_size;
-sem_t read_lock,write_lock;
-int readcnt;
+Sharded_cache_t cache;
+
+/* how requests were answered, counted for SIGUSR1 */
+static struct {
+    long store_hits; // sent from the store (-c)
+    long disk_hits; // sent from the disk tier (-d)
+    long coalesced_hits; // sent from another client's fetch
+    long revalidations; // stale responses revalidated with the server
+    long revalidated_hits; // of those, the ones still good (304)
+    long background_refreshes; // fetches of the refresher threads
+} events;
 
 //*************helper function**********************
-void serve_client(int clientfd);
 void sigint_handler(int sig);
-void clienterror(int fd, char *cause, char *errnum, 
-		 char *shortmsg, char *longmsg);
-int parse_request_uri(char * request_uri, char* host, char* port,
-	char* query);
+void sigusr1_handler(int sig);
+void usage(char* prog);
+void run_thread_per_connection(int listenfd);
 void *thread_for_client(void *vargp);
-int modified_open_clientfd(char *hostname, char *port);
 int read_request_line(rio_t * rio,
 char* method, char* request_uri ,char * version);
+bool serve_request(int clientfd, rio_t* rio_for_client);
 int handle_request_headers(rio_t* rio_for_client,
-	char* server_buf,char* host);
-int handle_response_from_server
-(int clientfd, rio_t* rio_for_server, char *request_uri);
+	Outvec_t* request,char* host,int* seen);
+int handle_response_from_server(int clientfd, rio_t* rio_for_server,
+    char *request_uri, bool* keeps_alive, Flight_t* flight, Cache_t** stale,
+    bool may_store);
+static void end_flight(Flight_t* flight);
+static void end_fetch(Cache_t* stale);
+static int add_validators(Outvec_t* request, Cache_t* stale);
+static int fetch_response(int clientfd, char* host, char* port,
+    Outvec_t* request, char* request_uri, bool* keeps_alive,
+    Flight_t* flight, Cache_t** stale, bool may_store);
+static void refresh_response(Cache_t* block, int sinkfd);
+static int tail_flight(int clientfd, Flight_t* flight, Cache_t* block);
+static ssize_t rio_readline_bulk(rio_t* rp, char* usrbuf, size_t maxlen);
 
 
 /* $begin proxy main */
@@ -63,27 +126,171 @@ int main(int argc, char **argv) {
 
     Signal(SIGPIPE, SIG_IGN);
     Signal(SIGINT, sigint_handler);
+    Signal(SIGUSR1, sigusr1_handler);
+
+    int listenfd;
+    int opt;
+    int nshards = DEFAULT_CACHE_SHARDS;
+    bool event_mode = false;
+    bool pin_cpus = false;
+    int nreactors = 0;
+    int nworkers = 0;
+    int nstealers = 0;
+    int queue_depth = DEFAULT_QUEUE_DEPTH;
+    Overload_policy_t policy = OVERLOAD_BLOCK;
+    char* disk_dir = NULL;
+    long disk_mb = DEFAULT_DISK_CACHE_MB;
+    char* store_path = NULL;
+    long store_mb = DEFAULT_STORE_MB;
+    long stale_window = 0;
+    Cache_policy_t cache_policy = CACHE_LRU;
+    /* Check command line args */
+    while ((opt = getopt(argc, argv, "aer:s:p:q:o:w:d:m:c:C:S:E:")) != -1) {
+        switch (opt) {
+        case 'E':
+            if (!strcmp(optarg, "lru"))
+                cache_policy = CACHE_LRU;
+            else if (!strcmp(optarg, "slru"))
+                cache_policy = CACHE_SLRU;
+            else if (!strcmp(optarg, "tinylfu"))
+                cache_policy = CACHE_TINYLFU;
+            else
+                usage(argv[0]);
+            break;
+        case 'S':
+            stale_window = atol(optarg);
+            if (stale_window < 0) {
+                fprintf(stderr, "stale window must not be negative\n");
+                exit(1);
+            }
+            break;
+        case 'd':
+            disk_dir = optarg;
+            break;
+        case 'm':
+            disk_mb = atol(optarg);
+            if (disk_mb < 1) {
+                fprintf(stderr, "disk cache size must be at least 1 MB\n");
+                exit(1);
+            }
+            break;
+        case 'c':
+            store_path = optarg;
+            break;
+        case 'C':
+            store_mb = atol(optarg);
+            if (store_mb < 1) {
+                fprintf(stderr, "store size must be at least 1 MB\n");
+                exit(1);
+            }
+            break;
+        case 'a':
+            pin_cpus = true;
+            break;
+        case 'e':
+            event_mode = true;
+            break;
+        case 'r':
+            nreactors = atoi(optarg);
+            if (nreactors < 1 || nreactors > MAX_REACTORS) {
+                fprintf(stderr, "reactors must be between 1 and %d\n",
+                    MAX_REACTORS);
+                exit(1);
+            }
+            break;
+        case 's':
+            nshards = atoi(optarg);
+            break;
+        case 'p':
+            nworkers = atoi(optarg);
+            if (nworkers < 1 || nworkers > MAX_WORKERS) {
+                fprintf(stderr, "workers must be between 1 and %d\n",
+                    MAX_WORKERS);
+                exit(1);
+            }
+            break;
+        case 'w':
+            nstealers = atoi(optarg);
+            if (nstealers < 1 || nstealers > MAX_WORKERS) {
+                fprintf(stderr, "workers must be between 1 and %d\n",
+                    MAX_WORKERS);
+                exit(1);
+            }
+            break;
+        case 'q':
+            queue_depth = atoi(optarg);
+            if (queue_depth < 1 || queue_depth > MAX_QUEUE_DEPTH) {
+                fprintf(stderr, "queue depth must be between 1 and %d\n",
+                    MAX_QUEUE_DEPTH);
+                exit(1);
+            }
+            break;
+        case 'o':
+            if (!strcmp(optarg, "block"))
+                policy = OVERLOAD_BLOCK;
+            else if (!strcmp(optarg, "reject"))
+                policy = OVERLOAD_REJECT;
+            else if (!strcmp(optarg, "drop"))
+                policy = OVERLOAD_DROP;
+            else
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc-1) {
+    	usage(argv[0]);
+    }
+    if (nshards < 1 || nshards > MAX_SHARDS) {
+        fprintf(stderr, "shards must be between 1 and %d\n", MAX_SHARDS);
+        exit(1);
+    }
+
+    init_sharded_cache(&cache, nshards, MAX_CACHE_SIZE, cache_policy);
+    init_refreshers(stale_window, refresh_response);
+    if (disk_dir && init_disk_cache(disk_dir, disk_mb<<20) == -1) {
+        fprintf(stderr, "cannot use %s for the disk cache\n", disk_dir);
+        exit(1);
+    }
+    if (store_path && init_store(store_path, store_mb<<20) == -1) {
+        fprintf(stderr, "cannot use %s for the store\n", store_path);
+        exit(1);
+    }
+    init_upstream_pool();
+    init_dns(getaddrinfo);
+    init_flights();
+    if (nreactors > 0) {
+        run_reactors(argv[optind], nreactors, pin_cpus);
+        return 0;
+    }
+    listenfd = Open_listenfd(argv[optind]);
+
+    if (event_mode)
+        run_event_loop(listenfd);
+    else if (nworkers > 0)
+        run_thread_pool(listenfd, nworkers, queue_depth, policy);
+    else if (nstealers > 0)
+        run_stealing_pool(listenfd, nstealers);
+    else
+        run_thread_per_connection(listenfd);
+    return 0;
+}
+/* $end proxy main */
 
-    int listenfd, *clientfd;
-    char hostname[MAXLINE], port[MAXLINE];
 
+/*
+    run_thread_per_connection: accept clients forever and start a
+    detached thread to serve each one
+*/
+/* $begin run_thread_per_connection */
+void run_thread_per_connection(int listenfd) {
+    int *clientfd;
+    char hostname[MAXLINE], port[MAXLINE];
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
     int rc;
-    Sem_init(&read_lock, 0, 1);
-    Sem_init(&write_lock, 0, 1);
-
-    cache = NULL;
-    total_cache_size = 0;
-    readcnt = 0;
     pthread_t tid;
-    /* Check command line args */
-    if (argc != 2) {
-    	fprintf(stderr, "usage: %s <port>\n", argv[0]);
-    	exit(1);
-    }
-
-    listenfd = Open_listenfd(argv[1]);
 
     while (1) {
 
@@ -120,20 +327,103 @@ int main(int argc, char **argv) {
                                               
     }
 }
+/* $end run_thread_per_connection */
 /* $end proxy main */
 
 
 /*
-    sigint_handler: free the cache when receive SIGINT signal
+    usage: print the command line usage and exit
+*/
+/* $begin usage */
+void usage(char* prog) {
+    fprintf(stderr, "usage: %s [-e | -r reactors [-a] |"
+        " -p workers [-q depth] [-o policy] | -w workers] [-s shards]"
+        " [-d dir [-m megabytes]] [-c file [-C megabytes]] [-S seconds]"
+        " [-E eviction] <port>\n", prog);
+    fprintf(stderr, "  -e           serve clients from one epoll event loop,\n"
+                    "               one request per connection\n");
+    fprintf(stderr, "  -r reactors  serve clients from this many event loops,\n"
+                    "               each with its own SO_REUSEPORT socket,\n"
+                    "               one request per connection\n");
+    fprintf(stderr, "  -a           pin each reactor to its own cpu\n");
+    fprintf(stderr, "  -p workers   serve clients from a fixed pool of"
+                    " threads\n");
+    fprintf(stderr, "  -q depth     slots in the pool's connection queue\n");
+    fprintf(stderr, "  -o policy    when the queue is full: block, reject"
+                    " (503) or drop\n");
+    fprintf(stderr, "  -w workers   serve clients from a pool of threads with\n"
+                    "               their own deques and work stealing\n");
+    fprintf(stderr, "  -s shards    number of cache shards\n");
+    fprintf(stderr, "  -d dir       keep large objects in files under dir\n");
+    fprintf(stderr, "  -m megabytes size of the disk cache (default %d)\n",
+        DEFAULT_DISK_CACHE_MB);
+    fprintf(stderr, "  -c file      keep the cached objects in this file"
+                    " across restarts\n");
+    fprintf(stderr, "  -C megabytes size of a new store file (default %d)\n",
+        DEFAULT_STORE_MB);
+    fprintf(stderr, "  -S seconds   send expired objects this long while they"
+                    " are refreshed\n");
+    fprintf(stderr, "  -E eviction  cache policy: lru (default), slru or"
+                    " tinylfu\n");
+    fprintf(stderr, "server names are remembered for %d seconds (failures for"
+                    " %d), getaddrinfo\ndoes not report the TTL of the"
+                    " records\n", DNS_TTL, DNS_NEGATIVE_TTL);
+    exit(1);
+}
+/* $end usage */
+
+
+/*
+    sigint_handler: free the cache, and remove the files of the disk
+    cache, when receive SIGINT signal
 */
 /* $begin sigint_handler */
 void sigint_handler(int sig) {
-    free_cache(cache);
+    free_sharded_cache(&cache);
+    free_disk_cache();
     exit(0);
 }
 /* $end sigint_handler */
 
 
+/*
+    sigusr1_handler: print the pool (with -p or -w), write, slab, cache
+    and event counters when receive SIGUSR1 signal, in every mode
+*/
+/* $begin sigusr1_handler */
+void sigusr1_handler(int sig) {
+    int olderrno=errno;
+    print_pool_stats();
+    print_outvec_stats();
+    print_slab_stats();
+    print_cache_stats(&cache);
+    print_event_stats();
+    errno=olderrno;
+}
+/* $end sigusr1_handler */
+
+/*
+    print_event_stats: print how requests were answered, only uses the
+    async-signal-safe sio functions
+*/
+void print_event_stats(void) {
+    sio_puts("events: store_hits=");
+    sio_putl(__atomic_load_n(&events.store_hits,__ATOMIC_RELAXED));
+    sio_puts(" disk_hits=");
+    sio_putl(__atomic_load_n(&events.disk_hits,__ATOMIC_RELAXED));
+    sio_puts(" coalesced_hits=");
+    sio_putl(__atomic_load_n(&events.coalesced_hits,__ATOMIC_RELAXED));
+    sio_puts(" revalidations=");
+    sio_putl(__atomic_load_n(&events.revalidations,__ATOMIC_RELAXED));
+    sio_puts(" revalidated_hits=");
+    sio_putl(__atomic_load_n(&events.revalidated_hits,__ATOMIC_RELAXED));
+    sio_puts(" background_refreshes=");
+    sio_putl(__atomic_load_n(&events.background_refreshes,
+        __ATOMIC_RELAXED));
+    sio_puts("\n");
+}
+
+
 
 /*
     thread_for_client: thread function to serve the client's request.
@@ -172,7 +462,10 @@ void * thread_for_client(void *vargp) {
 /*
     read_request_line: read the request line,
     get the method, request uri and version field.
+    Empty lines before it are skipped, a client may send them between
+    requests.
     return -1 when meet some error
+    return -2 when the client closed or stayed idle too long
     return 0 when success 
 
 */
@@ -180,17 +473,32 @@ void * thread_for_client(void *vargp) {
 int read_request_line(rio_t * rio, char* method, char* request_uri ,
 	char * version) {
     char buf[MAXLINE];
+    int result;
 
+    do {
+        result=rio_readline_bulk(rio, buf, MAXLINE);
+        if(result==0||(result==-1&&(errno==EAGAIN||errno==EWOULDBLOCK))) {
+            return -2; // no more requests
+        }
+        if(result==-1) {
+            return -1; // bad request line
+        }
+    } while(!strcmp(buf,"\r\n"));
     
-    int result=rio_readlineb(rio, buf, MAXLINE);
-    if(result==-1) {
-        return -1; // bad request line
-    }
+    return parse_request_line(buf,method,request_uri,version);
+}
+/* $end read_request_line*/
 
-    if(result==0) {
-        return -1; // bad request line
-    }
-    
+
+/*
+    parse_request_line: get the method, request uri and version field
+    from a request line already read.
+    return -1 when it is a bad request line
+    return 0 when success
+*/
+/* $begin parse_request_line*/
+int parse_request_line(char* buf, char* method, char* request_uri,
+	char* version) {
     if((sscanf(buf, "%s %s %s", method, request_uri, version))!=3) {
         return -1; // bad request line
     }
@@ -199,175 +507,684 @@ int read_request_line(rio_t * rio, char* method, char* request_uri ,
         return -1; // bad request line
     return 0;
 }
-/* $end read_request_line*/
+/* $end parse_request_line*/
 
 
 
 /*
     handle_request_headers: read the request headers from client and modified 
     them according to the requirement in writeup, 
-    save them in the buffer for server.
+    save them in the buffer for server. The caller ends them with
+    finish_request_headers, after it may add its own.
 
     return 0 when success
     return -1 when find some error
 */
 /* $begin handle_request_headers*/
 int handle_request_headers(rio_t* rio_for_client, 
-	char* server_buf, char* host) {
+	Outvec_t* request, char* host, int* seen) {
     
     char buf[MAXLINE];
-    char key[MAXLINE];
-    char value[MAXLINE]; 
-    if (rio_readlineb(rio_for_client, buf, MAXLINE) == -1) {      
+    if (rio_readline_bulk(rio_for_client, buf, MAXLINE) <= 0) {      
         return -1;
     }
 
-    // test if these headers appear
-    bool has_proxy_connection=false;
-    bool has_connection=false;
-    bool has_user_agent=false;
-    bool has_host=false;
+    // record which of the required headers appear
+    *seen=0;
 
     while(strcmp(buf, "\r\n")) {          
     	
-        if(sscanf(buf,"%s %s",key,value)!=2) {             
+        if(rewrite_request_header(buf,request,seen)==-1) {
              return -1;  // read header error
         }
-        if(!strncasecmp("Host",key,len_of_HOST)) {
-            has_host=true;
-            strcat(server_buf,buf);
-        }
-        else if(!strncasecmp("User-Agent",key,len_of_User_Agent)) {
-            has_user_agent=true;
-            strcat(server_buf,user_agent_hdr);
-        }
-        else if(!strncasecmp("Connection",key,len_of_Connection)) {
-            has_connection=true;
-            strcat(server_buf,connection_hdr);    
-        }
-        else if(!strncasecmp("Proxy-Connection",key,
-        	len_of_Proxy_Connection)) {
-            has_proxy_connection=true;
-            strcat(server_buf,proxy_connection_hdr);       
-        }
-        else
-            strcat(server_buf,buf);
 
-        if(rio_readlineb(rio_for_client, buf, MAXLINE)==-1) {
+        if(rio_readline_bulk(rio_for_client, buf, MAXLINE)<=0) {
             return -1; // read header error
         }
     }
-    // add the required headers
-    if(!has_host) {
-        strcat(server_buf,"Host: ");
-        strcat(server_buf,host);
-        strcat(server_buf,"\r\n");
-        
-    }
-    if(!has_user_agent)
-        strcat(server_buf,user_agent_hdr);
-    if(!has_connection)
-        strcat(server_buf,connection_hdr);
-    if(!has_proxy_connection)
-        strcat(server_buf,proxy_connection_hdr);
-    strcat(server_buf,buf);
     return 0;
 }
 /* $end handle_request_headers*/
 
+
 /*
-    handle_response_from_server: 
-    get the response from server and send them to client.
-    if the response's size is smaller than MAX_OBJECT_SIZE, put the response 
-    into cache;
-    return 0 when success finish
+    rewrite_request_header: modify one request header line from client
+    according to the requirement in writeup and add it to the request
+    for server; the required headers found are recorded in seen.
+    The connection headers are only between client and proxy, they are
+    dropped here and finish_request_headers adds the proxy's own. So
+    are the client's conditional headers: the proxy sends the whole
+    response, which it can cache, instead of the server's 304.
+    return 0 when success
+    return -1 when the header is bad or the request is full
+*/
+/* $begin rewrite_request_header*/
+int rewrite_request_header(char* buf, Outvec_t* out, int* seen) {
+    char key[MAXLINE];
+    char value[MAXLINE]; 
+
+    if(sscanf(buf,"%s %s",key,value)!=2) {             
+         return -1;  // read header error
+    }
+    if(!strncasecmp("Host",key,len_of_HOST)) {
+        *seen|=SEEN_HOST;
+        return outvec_str(out,buf);
+    }
+    else if(!strncasecmp("User-Agent",key,len_of_User_Agent)) {
+        *seen|=SEEN_USER_AGENT;
+        return outvec_ref(out,user_agent_hdr,strlen(user_agent_hdr));
+    }
+    else if(!strncasecmp("Connection",key,len_of_Connection)||
+        !strncasecmp("Proxy-Connection",key,len_of_Proxy_Connection)) {
+        // what the client wants for its own connection to the proxy
+        if(header_has_token(strchr(buf,':')+1,"close"))
+            *seen|=SEEN_CLOSE;
+        if(header_has_token(strchr(buf,':')+1,"keep-alive"))
+            *seen|=SEEN_KEEP_ALIVE;
+        return 0;
+    }
+    else if(!strncasecmp("Keep-Alive",key,len_of_Keep_Alive)) {
+        return 0;
+    }
+    else if(!strncasecmp("Authorization",key,len_of_Authorization)) {
+        *seen|=SEEN_AUTHORIZATION;
+    }
+    else if(!strncasecmp("Cache-Control",key,len_of_Cache_Control)||
+        !strncasecmp("Pragma",key,len_of_Pragma)) {
+        if(header_has_token(strchr(buf,':')+1,"no-cache"))
+            *seen|=SEEN_NO_CACHE;
+    }
+    else if(!strncasecmp("If-None-Match",key,len_of_If_None_Match)||
+        !strncasecmp("If-Modified-Since",key,len_of_If_Modified_Since)) {
+        // the proxy revalidates with its own validators, the client
+        // is sent the whole response
+        return 0;
+    }
+    return outvec_str(out,buf);
+}
+/* $end rewrite_request_header*/
+
+
+/*
+    finish_request_headers: add the required headers the client did not
+    send, the connection headers, and the empty line that ends the
+    headers. With keep_alive the server is asked to keep the connection
+    open, so it can go back to the upstream pool.
+    return 0 when success
+    return -1 when the request is full
+*/
+/* $begin finish_request_headers*/
+int finish_request_headers(Outvec_t* out, char* host, int seen,
+	int keep_alive) {
+    if(!(seen&SEEN_HOST)&&outvec_printf(out,"Host: %s\r\n",host)==-1)
+        return -1;
+    if(!(seen&SEEN_USER_AGENT)&&
+        outvec_ref(out,user_agent_hdr,strlen(user_agent_hdr))==-1)
+        return -1;
+    if(keep_alive) {
+        if(outvec_ref(out,keep_alive_hdr,strlen(keep_alive_hdr))==-1)
+            return -1;
+    }
+    else if(outvec_ref(out,connection_hdr,strlen(connection_hdr))==-1||
+        outvec_ref(out,proxy_connection_hdr,
+            strlen(proxy_connection_hdr))==-1)
+        return -1;
+    return outvec_ref(out,"\r\n",2);
+}
+/* $end finish_request_headers*/
+
+/*
+    The state of relaying one response from server to client
+*/
+struct response_relay {
+    int clientfd;
+    rio_t* rio; // reads from server
+    Cache_t* block; // the response is read into it for the cache,
+                    // NULL once it cannot be cached
+    long response_size; // bytes relayed so far
+    long pending; // bytes at the end of the block not written yet
+    Flight_t* flight; // the misses waiting for this response, or NULL
+    bool client_gone; // a write to client failed while streaming
+    Cache_t* stale; // the cached response being revalidated, or NULL
+    Http_response_t resp; // what the status line and headers say
+    int file; // file of the disk tier being filled, -1 if none
+    char file_path[MAXLINE];
+    long filed; // bytes written to file
+};
+
+/*
+    flush_relay: write the bytes kept back by relay_bytes to client
+    return -2 when write to client error
+    return 0 when success
+*/
+static int flush_relay(struct response_relay* r) {
+    if(r->pending==0)
+        return 0;
+    if(rio_writen(r->clientfd,
+        r->block->response+r->response_size-r->pending,r->pending)==-1)
+        return -2;
+    r->pending=0;
+    return 0;
+}
+
+/*
+    relay_room: make room in the block for n more bytes, it grows to
+    twice its size or to what is needed
+    return false when the response is too large to cache, the slab
+    arena has no room for it, or it is no longer cached
+*/
+static bool relay_room(struct response_relay* r, long n) {
+    long need=r->response_size+n;
+    long capacity;
+    Cache_t* grown;
+
+    if(r->block==NULL||need>=MAX_OBJECT_SIZE)
+        return false;
+    if(need>r->block->capacity) {
+        capacity=r->block->capacity*2;
+        if(capacity<need)
+            capacity=need;
+        if(capacity>=MAX_OBJECT_SIZE)
+            capacity=MAX_OBJECT_SIZE-1;
+        r->block->response_size=r->response_size; // what it keeps
+        if((grown=grow_cache_block(r->block,capacity))==NULL)
+            return false;
+        r->block=grown;
+    }
+    return true;
+}
+
+/*
+    not_cached: the response will not be cached, the clients waiting
+    for it are let go at once to fetch it themselves
+*/
+static void not_cached(struct response_relay* r) {
+    if(r->flight) {
+        flight_finish(r->flight,false);
+        r->flight=NULL;
+    }
+}
+
+/*
+    drop_block: the response will not be cached, write what is kept
+    back and free the block
+    return -2 when write to client error
+    return 0 when success
+*/
+static int drop_block(struct response_relay* r) {
+    not_cached(r);
+    if(r->block==NULL)
+        return 0;
+    if(flush_relay(r)==-2)
+        return -2;
+    release_cache_block(r->block);
+    r->block=NULL;
+    return 0;
+}
+
+/*
+    relay_bytes: relay bytes of the response to client and keep them
+    in the block while the response is small enough to cache. The
+    block is also what is written to client: the bytes are kept back
+    until flush_relay, so the status line and headers go out in one
+    write instead of one per line.
+    return -2 when write to client error
+    return 0 when success
+*/
+static int relay_bytes(struct response_relay* r, char* buf, long n) {
+    if(relay_room(r,n)) {
+        memcpy(r->block->response+r->response_size,buf,n);
+        r->response_size+=n;
+        r->pending+=n;
+        return 0;
+    }
+    if(drop_block(r)==-2||rio_writen(r->clientfd, buf, n)==-1)
+        return -2;
+    r->response_size+=n;
+    return 0;
+}
+
+/*
+    rio_readline_bulk: rio_readlineb, but the end of the line is found
+    with memchr in rio's buffer and the line copied at once, instead
+    of one rio_read call per byte
+    return the number of bytes, 0 at end of file, -1 on error
+*/
+static ssize_t rio_readline_bulk(rio_t* rp, char* usrbuf, size_t maxlen) {
+    size_t n=0,k;
+    char* nl=NULL;
+
+    while(n<maxlen-1&&nl==NULL) {
+        if(rp->rio_cnt<=0) {
+            rp->rio_cnt=read(rp->rio_fd,rp->rio_buf,sizeof(rp->rio_buf));
+            if(rp->rio_cnt<0) {
+                rp->rio_cnt=0;
+                if(errno==EINTR)
+                    continue;
+                return -1;
+            }
+            if(rp->rio_cnt==0)
+                break; // end of file
+            rp->rio_bufptr=rp->rio_buf;
+        }
+        k=rp->rio_cnt<maxlen-1-n? rp->rio_cnt : maxlen-1-n;
+        if((nl=memchr(rp->rio_bufptr,'\n',k))!=NULL)
+            k=nl-rp->rio_bufptr+1;
+        memcpy(usrbuf+n,rp->rio_bufptr,k);
+        rp->rio_bufptr+=k;
+        rp->rio_cnt-=k;
+        n+=k;
+    }
+    usrbuf[n]='\0';
+    return n;
+}
+
+/*
+    relay_line: read one line (at most maxlen-1 bytes) from server and
+    relay it
+    return the number of bytes, 0 at end of file
     return -1 when read from server error
     return -2 when write to client error
+*/
+static int relay_line(struct response_relay* r, char* buf, long maxlen) {
+    int n=rio_readline_bulk(r->rio, buf, maxlen);
+    if(n<=0)
+        return n;
+    if(relay_bytes(r,buf,n)==-2)
+        return -2;
+    return n;
+}
 
+/*
+    stream_body: read len bytes of body straight into the block, which
+    has room for them, publishing each read to the clients of flight
+    before it is written to client. When client goes away the body is
+    still read for them.
+    return -1 when server closed or read error before len bytes
+    return 0 when success
 */
-/* $begin handle_response_from_server*/
-int handle_response_from_server(int clientfd, rio_t* rio_for_server,
- char *request_uri) {
-    int n;
-    char buf[MAXLINE];
-    char response_buf[MAX_OBJECT_SIZE]; 
-    long response_size=0;
-    n=rio_readlineb(rio_for_server, buf, MAXLINE);
-    if(n==-1) {     
-        return -1;
+static int stream_body(struct response_relay* r, long len) {
+    char* p;
+    ssize_t n;
+
+    flight_stream(r->flight,r->block);
+    flight_progress(r->flight,r->response_size);
+    while(len>0) {
+        p=r->block->response+r->response_size;
+        n=read(r->rio->rio_fd,p,len);
+        if(n<0&&errno==EINTR)
+            continue;
+        if(n<=0)
+            return -1;
+        r->response_size+=n;
+        len-=n;
+        flight_progress(r->flight,r->response_size);
+        if(!r->client_gone&&rio_writen(r->clientfd,p,n)==-1)
+            r->client_gone=true;
     }
-    if(rio_writen(clientfd, buf, n)==-1) {
-            
+    return 0;
+}
+
+/*
+    relay_body: relay exactly len bytes of body (len<0: up to the
+    server closing the connection). What rio already read ahead is
+    relayed from its buffer, the rest is spliced from socket to socket
+    (see zerocopy.c) and only copied while it can still be cached,
+    straight into the block, or into the file when the disk tier is
+    filled. A body that fits the block while others miss the same url
+    is read into the block instead, see stream_body. Without a length
+    the block grows as the bytes arrive: the splices stop when it is
+    full, and it is made twice as large before they go on.
+    return -1 when server closed or read error before len bytes
+    return -2 when write to client error
+    return 0 when success
+*/
+static int relay_body(struct response_relay* r, long len) {
+    rio_t* rio=r->rio;
+    long n,moved,filed;
+    int rc,file;
+
+    if(rio->rio_cnt>0&&len!=0) {
+        n=len>0&&len<rio->rio_cnt? len : rio->rio_cnt;
+        if(relay_bytes(r,rio->rio_bufptr,n)==-2)
             return -2;
+        rio->rio_bufptr+=n;
+        rio->rio_cnt-=n;
+        if(len>0)
+            len-=n;
     }
-     while(n != 0) {
-     	// record the response
-        if(response_size+n<MAX_OBJECT_SIZE) {
-            memcpy((response_buf+response_size),buf,n);          
+    if(len==0)
+        return 0;
+
+    if(flush_relay(r)==-2)
+        return -2;
+    if(r->file>=0&&r->filed==0) {
+        // the file starts with what was relayed before the splices
+        if(r->block==NULL||
+            rio_writen(r->file,r->block->response,r->response_size)==-1) {
+            disk_end_fill(r->file,r->file_path,NULL,0,false,0,false);
+            r->file=-1;
         }
-        // update the response size
-        response_size = response_size+n;
+        else
+            r->filed=r->response_size;
+    }
+    if(!relay_room(r,len>0? len : 1)&&drop_block(r)==-2)
+        return -2;
+    if(r->flight&&r->block&&len>0)
+        return stream_body(r,len);
+    file=r->file;
+    while(1) {
+        rc=splice_body(rio->rio_fd,r->clientfd,len,
+            r->block? r->block->response+r->response_size : NULL,
+            r->block? r->block->capacity-r->response_size : 0,
+            file, &moved, &filed);
+        r->response_size+=moved;
+        r->filed+=filed;
+        if(rc!=1)
+            return rc;
+        if(filed<moved)
+            file=-1; // splice_body gave the file up, it is not kept
+        // the block is full, only a body without a length gets here
+        if(!relay_room(r,1)&&drop_block(r)==-2)
+            return -2;
+    }
+}
 
-        n=rio_readlineb(rio_for_server, buf, MAXLINE);
-        if(n==-1) {
+/*
+    relay_chunked_body: relay a chunked body as it is, chunk by chunk,
+    up to the last chunk and the trailers
+    return -1 when read from server error or bad chunk
+    return -2 when write to client error
+    return 0 when success
+*/
+static int relay_chunked_body(struct response_relay* r) {
+    char buf[MAXLINE];
+    char* end;
+    long size;
+    int n;
+    while(1) {
+        n=relay_line(r,buf,MAXLINE);
+        if(n<=0)
+            return n==0? -1 : n;
+        size=strtol(buf,&end,16);
+        if(end==buf||size<0)
             return -1;
-        }
-        if(rio_writen(clientfd, buf, n)==-1) {
-    
+        if(size==0)
+            break;
+        // the chunk data and the CRLF after it
+        if((n=relay_body(r,size+2))<0)
+            return n;
+    }
+    // the trailers, up to an empty line
+    do {
+        n=relay_line(r,buf,MAXLINE);
+        if(n<=0)
+            return n==0? -1 : n;
+    } while(strcmp(buf,"\r\n"));
+    return 0;
+}
+
+/*
+    relay_response: relay the status line, the headers and the body.
+    The status line and headers tell how the body ends (Content-Length,
+    chunked, or the server closing the connection), so the connection
+    can be used for another request when the server keeps it open;
+    *keeps_alive tells if it can. A response the caching headers do
+    not let the proxy keep is relayed without its block (see
+    response_is_cacheable). *cacheable is cleared for a chunked
+    response, a HTTP/1.0 client could not read it from the cache.
+    return 0 when success, but what is kept back is not written yet
+    return -1 when read from server error
+    return -2 when write to client error
+    return -3 when server closed before sending anything
+*/
+static int relay_response(struct response_relay* r, bool* keeps_alive,
+    bool* cacheable) {
+    int n,rc;
+    char buf[MAXLINE];
+    Http_response_t* resp=&r->resp;
+
+    n=rio_readline_bulk(r->rio, buf, MAXLINE);
+    if(n<=0) {     
+        return -3;
+    }
+    if(relay_bytes(r,buf,n)==-2) {
+        return -2;
+    }
+
+    if(parse_status_line(buf,resp)==-1) {
+        // not a HTTP/1.x response, relay it until server closes
+        if(drop_block(r)==-2)
             return -2;
+        return relay_body(r,-1);
+    }
+    // the headers, up to an empty line
+    do {
+        n=relay_line(r,buf,MAXLINE);
+        if(n<=0)
+            return n==0? -1 : n;
+        parse_response_header(buf,resp);
+    } while(strcmp(buf,"\r\n"));
+    // a 304 answering a revalidation is kept back, the cached response
+    // is sent instead
+    if(!(resp->status==304&&r->stale)&&
+        !response_is_cacheable(resp,time(NULL))&&drop_block(r)==-2)
+        return -2;
+
+    if(!response_has_body(resp))
+        rc=0;
+    else if(resp->chunked) {
+        not_cached(r);
+        rc=relay_chunked_body(r);
+    }
+    else if(resp->content_length>=0) {
+        // too big for the memory cache, the disk tier may take it
+        long size=r->response_size+resp->content_length;
+        if(r->block&&disk_cache_enabled()&&
+            size>=MAX_OBJECT_SIZE&&size<=disk_max_object())
+            r->file=disk_begin_fill(r->file_path);
+        rc=relay_body(r,resp->content_length);
+    }
+    else
+        rc=relay_body(r,-1);
+    *keeps_alive=response_keeps_alive(resp);
+    *cacheable=!resp->chunked;
+    return rc;
+}
+
+/*
+    revalidated: the server answered 304 to the revalidation of
+    r->stale, whose headers the 304's update. The block is not
+    changed, as clients may be reading it: a copy with the updated
+    headers (see update_response_head) takes its place in the cache
+    and the store, fresh from now on, and is handed to the clients of
+    r->flight. When the copy cannot be made, only the expiry of
+    r->stale moves, in memory.
+    return the copy, held for the caller, NULL when there is none
+*/
+static Cache_t* revalidated(struct response_relay* r) {
+    Http_response_t merged;
+    Cache_t* stale=r->stale;
+    Cache_t* block;
+    time_t now=time(NULL);
+    size_t capacity=stale->response_size+r->response_size;
+    long size=-1;
+
+    if(capacity>=MAX_OBJECT_SIZE)
+        capacity=MAX_OBJECT_SIZE-1;
+    if((block=new_cache_block(stale->url,capacity))!=NULL)
+        size=update_response_head(stale->response,stale->response_size,
+            r->block->response,r->response_size,block->response,capacity);
+    if(block==NULL||size<=0||
+        parse_response_head(block->response,size,&merged)==-1) {
+        if(block)
+            release_cache_block(block);
+        if(parse_response_head(stale->response,stale->response_size,
+            &merged)==0) {
+            merge_response_head(r->block->response,r->response_size,
+                &merged);
+            set_freshness(stale,now,response_expires(&merged,now),
+                response_stale_window(&merged));
+        }
+        if(r->flight) {
+            flight_stream(r->flight,stale);
+            flight_finish(r->flight,true);
         }
+        return NULL;
     }
 
-    if(response_size<MAX_OBJECT_SIZE&&response_size>0) {
-    	// put the response into cache when the size is suitable
-        Cache_t* new_cache_block=
-        construct_cache_block(request_uri,response_buf,response_size);
-
-        P(&write_lock);
-        while(total_cache_size+response_size>MAX_CACHE_SIZE) {
-        	//evict to get enough pace
-            if(evict_cache(&total_cache_size,&cache)==-1) {
-            	fprintf(stderr, "cache evict error\n");
-            	V(&write_lock);
-            	return 0; // do not cache and return as normal
-            }
+    block->response_size=size;
+    block->keeps_alive=stale->keeps_alive;
+    set_freshness(block,now,response_expires(&merged,now),
+        response_stale_window(&merged));
+    if(store_enabled())
+        store_insert(block->url,block->response,size,block->keeps_alive);
+    hold_cache_block(block); // the caller's
+    if(r->flight)
+        flight_stream(r->flight,block);
+    insert_to_shard(block,select_shard(block->hash,&cache));
+    if(r->flight)
+        flight_finish(r->flight,true);
+    return block;
+}
+
+/*
+    handle_response_from_server: 
+    get the response from server and send them to client.
+    *keeps_alive tells if the server connection can be used for
+    another request, the client keeps its own connection under the
+    same rule.
+    if the response's size is smaller than MAX_OBJECT_SIZE, it was
+    read straight into a cache block, which goes into the cache as it
+    is: a cached response is copied only once. The block is also
+    handed to the clients of flight that missed the same url while it
+    was fetched, they tail it while it is filled (see flight.c).
+    It is fresh until its headers say (see response_expires), and
+    may be sent stale a while longer (see refresh.c).
+    When *stale is being revalidated and the server answers 304,
+    nothing is written to client: *stale is replaced by a copy with
+    the updated headers, which is handed to flight (see revalidated).
+    The caller's reference moves to the copy.
+    Nothing is cached when may_store is false.
+    return 1 when the server answered 304 to the revalidation
+    return 0 when success finish
+    return -1 when read from server error
+    return -2 when write to client error
+    return -3 when server closed before sending anything
+
+*/
+/* $begin handle_response_from_server*/
+int handle_response_from_server(int clientfd, rio_t* rio_for_server,
+    char *request_uri, bool* keeps_alive, Flight_t* flight, Cache_t** stale,
+    bool may_store) {
+    struct response_relay r;
+    Cache_t* copy;
+    bool cacheable=true;
+    int rc;
+
+    *keeps_alive=false;
+    r.clientfd=clientfd;
+    r.rio=rio_for_server;
+    r.block=may_store? new_cache_block(request_uri,CACHE_FILL_CHUNK) : NULL;
+    r.response_size=0;
+    r.pending=0;
+    r.flight=flight;
+    r.client_gone=false;
+    r.stale=*stale;
+    r.file=-1;
+    r.filed=0;
+
+    rc=relay_response(&r,keeps_alive,&cacheable);
+    if(rc==0&&r.stale&&r.resp.status==304&&r.pending==r.response_size) {
+        if((copy=revalidated(&r))!=NULL) {
+            release_cache_block(*stale);
+            *stale=copy;
         }
+        release_cache_block(r.block);
+        return 1;
+    }
+    if(rc==0)
+        rc=flush_relay(&r);
+    if(r.file>=0) {
+        disk_end_fill(r.file,r.file_path,request_uri,r.response_size,
+            *keeps_alive,response_expires(&r.resp,time(NULL)),
+            rc==0&&r.filed==r.response_size);
+    }
 
-        add_to_cache(new_cache_block,&cache);
-        total_cache_size=total_cache_size+response_size;
-        V(&write_lock);
-     }
-     return 0;
+    if(rc==0&&cacheable&&r.block&&r.response_size>0) {
+        // put the response into cache when the size is suitable
+        r.block->response_size=r.response_size;
+        r.block->keeps_alive=*keeps_alive;
+        set_freshness(r.block,time(NULL),response_expires(&r.resp,
+            time(NULL)),response_stale_window(&r.resp));
+        if(store_enabled())
+            store_insert(request_uri,r.block->response,r.response_size,
+                *keeps_alive);
+        if(r.flight)
+            flight_stream(r.flight,r.block); // for the waiting clients
+        insert_to_shard(r.block,select_shard(r.block->hash,&cache));
+        if(r.flight)
+            flight_finish(r.flight,true);
+    }
+    else if(r.block)
+        release_cache_block(r.block);
+    if(rc==0&&r.client_gone)
+        rc=-2;
+    return rc;
 }
 /* $end handle_response_from_server*/
 
 
 /*
-  serve_client - handle one HTTP request/response transaction for client
+  serve_client - serve the requests of one client connection one after
+  another, as long as the client and the responses keep it open.
+  Pipelined requests need nothing special: each request is read in
+  full before its response is sent, so the next one is simply what
+  follows in rio_for_client's buffer.
+*/
+/* $begin serve_client */
+void serve_client(int clientfd) {
+    rio_t rio_for_client;
+    struct timeval timeout={CLIENT_IDLE_TIMEOUT,0};
+
+    // an idle client must not hold its thread for ever
+    if(setsockopt(clientfd,SOL_SOCKET,SO_RCVTIMEO,&timeout,
+        sizeof(timeout))<0) {
+        fprintf(stderr, "setsockopt error:%s\n",strerror(errno));
+    }
+    Rio_readinitb(&rio_for_client, clientfd);
+    while(serve_request(clientfd,&rio_for_client))
+        ;
+}
+/* $end serve_client */
+
+
+/*
+  serve_request - handle one HTTP request/response transaction for client
    parse the request line and headers, If find corresponding response in
    cache, just use it for response, otherwise, connect to server and get
    response, also save the response in cache when necessary.
- 
+   return true when the client connection can take another request
  */
-
-/* $begin serve_client */
-void serve_client(int clientfd) {
-   
-    char server_buf[MAXLINE],method[MAXLINE],
-    request_uri[MAXLINE],version[MAXLINE],query[MAXLINE];
- 
-    rio_t rio_for_client,rio_for_server;
+/* $begin serve_request */
+bool serve_request(int clientfd, rio_t* rio_for_client) {
+    char method[MAXLINE],request_uri[MAXLINE],version[MAXLINE],
+    query[MAXLINE];
+    Outvec_t request; // the rewritten request for server
     char host[MAXLINE],port[MAXLINE];
-
-   
-    Rio_readinitb(&rio_for_client, clientfd);
+    int seen,minor_version,result;
+    bool keep_client,keeps_alive;
 
     
      /* Read request line*/
-    if(read_request_line(&rio_for_client,method,request_uri,version)==-1) {
+    result=read_request_line(rio_for_client,method,request_uri,version);
+    if(result==-2) {
+        return false; // the client is done
+    }
+    if(result==-1) {
        
         fprintf(stderr,"bad request line\n");    
-        return;
+        return false;
     }
 
 
@@ -375,105 +1192,280 @@ void serve_client(int clientfd) {
         
         clienterror(clientfd, method, "501", "Not Implemented",
                     "proxy does not implement this method");   
-        return;
+        return false; // the request body, if any, was not read
     }
 
-    P(&read_lock);
-    readcnt++;
+    if(parse_request_uri(request_uri,host,port,query)==-1) {
+        
+        fprintf(stderr, "invalid request uri error = %s\n",strerror(errno));
+        return false;     
+    }
+
+    /* handle the request headers, they are read before the cache is
+       searched so the next request on the connection starts clean.
+       The request goes to the server in the client's HTTP version,
+       so the client can read the response as it is.
+    */
+    minor_version=!strcasecmp(version,"HTTP/1.1");
+    outvec_init(&request);
+    if(outvec_printf(&request, "%s %s %s\r\n",method,query,
+        minor_version? "HTTP/1.1" : "HTTP/1.0")==-1||
+        handle_request_headers(rio_for_client,&request,host,&seen)==-1) {
+        fprintf(stderr, "proxy read headers error:%s\n",strerror(errno));    
+        return false;
+    }
+    // HTTP/1.1 clients keep the connection unless they say close,
+    // HTTP/1.0 clients only when they say keep-alive
+    keep_client=!(seen&SEEN_CLOSE)&&(minor_version||(seen&SEEN_KEEP_ALIVE));
+
     printf("Receive request uri = %s\n",request_uri);
-    if (readcnt == 1)
-        P(&write_lock);
-    V(&read_lock);
-    // search if the request is cached
-    Cache_t* hit_cache=find_in_cache(request_uri,cache);
+    unsigned long hash=cache_hash(request_uri);
+    Cache_shard_t* shard=select_shard(hash,&cache);
+    time_t now=time(NULL);
+    // the response to a request with credentials is not shared
+    bool may_store=!(seen&SEEN_AUTHORIZATION);
+    /* search if the request is cached, a hit holds a reference to
+       the block, so it is written without being inside the cache.
+       One that is no longer fresh, nor in its stale window (or the
+       client asks for no-cache) is revalidated with the server when
+       it has a validator, and fetched again otherwise */
+    Cache_t* hit_cache=lookup_shard(request_uri,hash,shard);
+    Cache_t* stale=NULL;
+    if(hit_cache&&((seen&SEEN_NO_CACHE)||!refresh_hit(hit_cache,now))) {
+        stale=hit_cache;
+        hit_cache=NULL;
+        if(!may_store||add_validators(&request,stale)<=0) {
+            release_cache_block(stale);
+            stale=NULL;
+        }
+    }
     if(hit_cache) {
     	/*if hit*/
         printf("Cache Hit!!!!!!!\n");
         
-        if(rio_writen(clientfd, hit_cache->response,
-        	hit_cache->response_size)==-1) {
+        Outvec_t out;
+        outvec_init(&out);
+        outvec_ref(&out,hit_cache->response,hit_cache->response_size);
+        if(outvec_write(clientfd,&out)==-1) {
             fprintf(stderr, "write cached object to client error:%s\n"
             	,strerror(errno));
+            keep_client=false;
         }
-        P(&read_lock);
-        readcnt--;
-        if(readcnt==0)
-            V(&write_lock);
-        V(&read_lock);
-        // update the time stamp
-        P(&write_lock);
-        update_time_stamp(hit_cache,cache);
-        V(&write_lock);
-        return;
+        keep_client=keep_client&&hit_cache->keeps_alive;
+        release_cache_block(hit_cache);
+        return keep_client;
     }
-    /*
-		if miss
-    */
-    P(&read_lock);
-    readcnt--;
-    if(readcnt==0)
-        V(&write_lock);
-    V(&read_lock);
-    // update the time stamp
-    P(&write_lock);
-    update_time_stamp(hit_cache,cache);
-    V(&write_lock);
-
-    printf("Cache Miss!!!!!!!\n");
-    if(parse_request_uri(request_uri,host,port,query)==-1) {
-        
-        fprintf(stderr, "invalid request uri error = %s\n",strerror(errno));
-        return;     
+    // the store may have it from before, it is sent from the mapping
+    // and put back into the memory cache
+    Store_hit_t stored;
+    time_t expires=0;
+    long stale_window=0;
+    bool stored_hit=stale==NULL&&!(seen&SEEN_NO_CACHE)&&
+        store_enabled()&&store_lookup(request_uri,&stored);
+    if(stored_hit&&(expires=stored_response_expires(stored.response,
+        stored.size,now,&stale_window))<=now) {
+        store_release(&stored); // no longer fresh, fetched again
+        stored_hit=false;
     }
+    if(stored_hit) {
+        __atomic_fetch_add(&events.store_hits,1,__ATOMIC_RELAXED);
 
-
-    int serverfd;
-    /* I modified the open_clientfd function, so it won't exit for 
-       invalid host and port
-    */
-    serverfd = modified_open_clientfd(host, port);
-    if(serverfd ==-1) {
-        fprintf(stderr, "proxy cannot connect to server error:%s\n",
-        	strerror(errno));
-        return;
+        Outvec_t out;
+        outvec_init(&out);
+        outvec_ref(&out,stored.response,stored.size);
+        if(outvec_write(clientfd,&out)==-1) {
+            fprintf(stderr, "write cached object to client error:%s\n"
+            	,strerror(errno));
+            keep_client=false;
+        }
+        Cache_t* new_cache_block=
+        construct_cache_block(request_uri,stored.response,stored.size);
+        if(new_cache_block) {
+            new_cache_block->keeps_alive=stored.keeps_alive;
+            set_freshness(new_cache_block,now,expires,stale_window);
+            insert_to_shard(new_cache_block,shard);
+        }
+        keep_client=keep_client&&stored.keeps_alive;
+        store_release(&stored);
+        return keep_client;
     }
-
-
-    // handle the request headers
-    sprintf(server_buf, "%s %s %s\r\n",method,query,"HTTP/1.0"); 
-     
-    if(handle_request_headers(&rio_for_client,server_buf,host)==-1) {
-        fprintf(stderr, "proxy read headers error:%s\n",strerror(errno));    
-        Close(serverfd);
-        return;
+    // a large object may be in the disk tier, it is sent from its file
+    if(stale==NULL&&!(seen&SEEN_NO_CACHE)&&
+        (result=disk_send(clientfd,request_uri,&keeps_alive))!=0) {
+        __atomic_fetch_add(&events.disk_hits,1,__ATOMIC_RELAXED);
+        if(result==-1) {
+            fprintf(stderr, "write cached object to client error:%s\n"
+            	,strerror(errno));
+            return false;
+        }
+        return keep_client&&keeps_alive;
     }
- 
-    if(rio_writen(serverfd,server_buf, strlen(server_buf))==-1) {
-        fprintf(stderr, "proxy write to server error:%s\n",strerror(errno));
-        Close(serverfd);
-        return;
+    if(finish_request_headers(&request,host,seen,1)==-1) {
+        fprintf(stderr, "proxy read headers error:%s\n",strerror(errno));
+        end_fetch(stale);
+        return false;
     }
+    /*
+		if miss, join the other clients missing the same url: the first
+		one fetches (or revalidates) it, the others wait for its block
+    */
+    bool leader=true;
+    Flight_t* flight=NULL;
+    if(may_store)
+        flight=flight_join(request_uri,hash,&leader);
+    if(!leader) {
+        hit_cache=flight_wait(flight);
+        if(hit_cache) {
+            __atomic_fetch_add(&events.coalesced_hits,1,__ATOMIC_RELAXED);
+            result=tail_flight(clientfd,flight,hit_cache);
+            if(result==-2) {
+                fprintf(stderr, "write cached object to client error:%s\n"
+                    ,strerror(errno));
+            }
+            keep_client=result==0&&keep_client&&hit_cache->keeps_alive;
+            release_cache_block(hit_cache);
+            flight_leave(flight);
+            end_fetch(stale);
+            return keep_client;
+        }
+        flight_leave(flight);
+        flight=NULL;
+        // the response is not cached, fetch it alone
+    }
+    if(stale)
+        __atomic_fetch_add(&events.revalidations,1,__ATOMIC_RELAXED);
+    else
+        printf("Cache Miss!!!!!!!\n");
+
+    result=fetch_response(clientfd,host,port,&request,request_uri,
+        &keeps_alive,flight,&stale,may_store);
+    end_flight(flight);
+    if(result==1) {
+        // still good, it is sent like a hit
+        __atomic_fetch_add(&events.revalidated_hits,1,__ATOMIC_RELAXED);
+        Outvec_t out;
+        outvec_init(&out);
+        outvec_ref(&out,stale->response,stale->response_size);
+        if(outvec_write(clientfd,&out)==-1) {
+            fprintf(stderr, "write cached object to client error:%s\n"
+            	,strerror(errno));
+            keep_client=false;
+        }
+        keep_client=keep_client&&stale->keeps_alive;
+        result=0;
+    }
+    else
+        keep_client=keep_client&&keeps_alive;
+    end_fetch(stale);
+    return result==0&&keep_client;
+}
+/* $end serve_request */
 
+/*
+    fetch_response: send request to the server at host and port, on an
+    idle connection from the upstream pool when there is one, and relay
+    its response to clientfd (see handle_response_from_server). The
+    connection goes back to the pool when the server keeps it open.
+    return what handle_response_from_server returns, 1 or 0 when
+    success, and -1 also when the server cannot be reached
+*/
+/* $begin fetch_response */
+static int fetch_response(int clientfd, char* host, char* port,
+    Outvec_t* request, char* request_uri, bool* keeps_alive,
+    Flight_t* flight, Cache_t** stale, bool may_store) {
+    rio_t rio_for_server;
+    int serverfd,result;
+    bool reused;
+
+    while(1) {
+        /* take an idle connection to the server from the pool, or open
+           a new one with modified_open_clientfd
+        */
+        serverfd = upstream_connect(host, port, &reused);
+        if(serverfd ==-1) {
+            fprintf(stderr, "proxy cannot connect to server error:%s\n",
+            	strerror(errno));
+            return -1;
+        }
 
-    // get response from server
-    Rio_readinitb(&rio_for_server, serverfd);
-    int result;
-    result=handle_response_from_server(clientfd,&rio_for_server,request_uri);
-    if(result==-1) {
+        if(outvec_write(serverfd,request)==-1) {
+            Close(serverfd);
+            if(reused)
+                continue; // the server closed the idle connection
+            fprintf(stderr, "proxy write to server error:%s\n",
+                strerror(errno));
+            return -1;
+        }
+
+        // get response from server
+        Rio_readinitb(&rio_for_server, serverfd);
+        result=handle_response_from_server(clientfd,&rio_for_server,
+            request_uri,keeps_alive,flight,stale,may_store);
+        if(result==-3&&reused) {
+            Close(serverfd);
+            continue; // the server closed the idle connection
+        }
+        break;
+    }
+    if(result==-1||result==-3) {
         fprintf(stderr, "proxy read from server error:%s\n",strerror(errno));
         Close(serverfd);
-        return;
+        return result;
     }
     if(result==-2) { 
         fprintf(stderr, "write response object to client error:%s\n",
         	strerror(errno));
         Close(serverfd);
+        return result;
+    }
+    // nothing may be left over that belongs to no request
+    if(*keeps_alive&&rio_for_server.rio_cnt==0)
+        upstream_release(host, port, serverfd);
+    else
+        Close(serverfd);
+    return result;
+}
+/* $end fetch_response */
+
+/*
+    refresh_response: fetch the response of a cached block again, run
+    by the refresher threads (see refresh.c). It goes through the miss
+    path like a client's request, revalidating the block when it has
+    validators, and its response is written to sinkfd. Nothing is done
+    when a client is fetching the url already.
+*/
+static void refresh_response(Cache_t* block, int sinkfd) {
+    char host[MAXLINE],port[MAXLINE],query[MAXLINE];
+    Outvec_t request;
+    Flight_t* flight;
+    Cache_t* stale=block;
+    bool leader,keeps_alive;
+    int rc;
+
+    if(parse_request_uri(block->url,host,port,query)==-1)
+        return;
+    outvec_init(&request);
+    if(outvec_printf(&request,"GET %s HTTP/1.1\r\n",query)==-1||
+        (rc=add_validators(&request,block))==-1||
+        finish_request_headers(&request,host,0,1)==-1)
         return;
+    if(rc==0)
+        stale=NULL; // no validators, it is fetched again
+    flight=flight_join(block->url,block->hash,&leader);
+    if(leader) {
+        __atomic_fetch_add(&events.background_refreshes,1,
+            __ATOMIC_RELAXED);
+        // the fetch's own reference, a 304 moves it to the copy
+        if(stale)
+            hold_cache_block(stale);
+        fetch_response(sinkfd,host,port,&request,block->url,&keeps_alive,
+            flight,&stale,true);
+        end_flight(flight);
+        end_fetch(stale);
     }
-    Close(serverfd);
-    return;
+    else
+        flight_leave(flight);
 }
-/* $end serve_client */
 
 /*
     parse_request_uri: get host, port and query from the given request uri,
@@ -552,28 +1544,26 @@ int parse_request_uri( char * request_uri, char* host, char* port,
 void clienterror(int fd, char *cause, char *errnum, 
          char *shortmsg, char *longmsg){
 
-    char buf[MAXLINE], body[MAXBUF];
+    char body[MAXBUF];
+    Outvec_t out;
 
     /* Build the HTTP response body */
-    sprintf(body, "<html><title>Tiny Error</title>");
-    sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-    sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-    sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-    sprintf(body, "%s<hr><em>The kaimin's proxy </em>\r\n", body);
-
-    /* Print the HTTP response */
-    sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    // I just use the rio bucause 
-    if(rio_writen(fd, buf, strlen(buf))==-1) 
-        return;
-    sprintf(buf, "Content-type: text/html\r\n");
-    if(rio_writen(fd, buf, strlen(buf))==-1)
-        return;
-    sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-    if(rio_writen(fd, buf, strlen(buf))==-1)
-        return;
-    if(rio_writen(fd, body, strlen(body))==-1)
+    snprintf(body, MAXBUF, "<html><title>Tiny Error</title>"
+        "<body bgcolor=""ffffff"">\r\n"
+        "%s: %s\r\n"
+        "<p>%s: %s\r\n"
+        "<hr><em>The kaimin's proxy </em>\r\n",
+        errnum, shortmsg, longmsg, cause);
+
+    /* Print the HTTP response, the headers and the body in one writev */
+    outvec_init(&out);
+    if(outvec_printf(&out, "HTTP/1.0 %s %s\r\n"
+        "Content-type: text/html\r\n"
+        "Content-length: %d\r\n\r\n",
+        errnum, shortmsg, (int)strlen(body))==-1||
+        outvec_ref(&out, body, strlen(body))==-1)
         return;
+    outvec_write(fd, &out);
 }
 /* $end clienterror */
 
@@ -583,49 +1573,93 @@ void clienterror(int fd, char *cause, char *errnum,
         Open connection to server at <hostname, port> and
         return a socket descriptor ready for reading and writing. This
         function is reentrant and protocol-independent.
+        The addresses come from the resolver's cache (see dns.c) and
+        are raced against each other instead of tried one by one,
+        starting with the address family that won last time (see
+        connect.c).
  
     On error, returns -1 and sets errno.
 */
 
 /* $begin modified_open_clientfd*/
 int modified_open_clientfd(char *hostname, char *port) {
-    int clientfd;
-    struct addrinfo hints, *listp, *p;
-
-    /* Get a list of potential server addresses */
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_socktype = SOCK_STREAM;  /* Open a connection */
-    hints.ai_flags = AI_NUMERICSERV;  /* ... using a numeric port arg. */
-    hints.ai_flags |= AI_ADDRCONFIG;  /* Recommended for connections */
-
-
+    int clientfd,prefer,family;
 
 /***I modified here because the Getaddrinfo exit when some error occurs***/
    // Getaddrinfo(hostname, port, &hints, &listp);
-    int rc;
-
-    if ((rc = getaddrinfo(hostname, port, &hints, &listp)) != 0) {
-        fprintf(stderr, "%s: %s\n", "Getaddrinfo error", gai_strerror(rc));
+    Dns_result_t* dns=dns_lookup(hostname,port);
+    if(dns->error) {
+        dns_release(dns);
         return -1; 
     }
-    /* Walk the list for one that we can successfully connect to */
-    for (p = listp; p; p = p->ai_next) {
-        /* Create a socket descriptor */
-        if ((clientfd = socket(p->ai_family, p->ai_socktype,
-         p->ai_protocol)) < 0) 
-            continue; /* Socket failed, try the next */
 
-        /* Connect to the server */
-        if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1) 
-            break; /* Success */
-        Close(clientfd); /* Connect failed, try another */ 
-    } 
+    prefer=dns_preferred_family(hostname,port);
+    clientfd=race_connect(dns->addrs,prefer,&family);
 
     /* Clean up */
-    Freeaddrinfo(listp);
-    if (!p) /* All connects failed */
-        return -1;
-    else    /* The last connect succeeded */
-        return clientfd;
+    dns_release(dns);
+    if(clientfd>=0&&family!=prefer)
+        dns_remember_family(hostname,port,family);
+    return clientfd;
 }
 /* $end modified_open_clientfd*/
+
+/*
+    end_flight: let the clients waiting for this fetch go, when the
+    response did not give them a block, and leave the flight
+*/
+static void end_flight(Flight_t* flight) {
+    if(flight==NULL)
+        return;
+    flight_finish(flight,false);
+    flight_leave(flight);
+}
+
+/*
+    end_fetch: drop the reference to the block that was to be
+    revalidated
+*/
+static void end_fetch(Cache_t* stale) {
+    if(stale)
+        release_cache_block(stale);
+}
+
+/*
+    add_validators: ask the server to answer 304 when the cached
+    response stale is still good, with its ETag and Last-Modified
+    return 1 when they are added
+    return 0 when it has none, it cannot be revalidated
+    return -1 when the request is full
+*/
+static int add_validators(Outvec_t* request, Cache_t* stale) {
+    Http_response_t cached;
+
+    if(parse_response_head(stale->response,stale->response_size,
+        &cached)==-1||(!cached.etag[0]&&!cached.last_modified[0]))
+        return 0;
+    if(cached.etag[0]&&
+        outvec_printf(request,"If-None-Match: %s\r\n",cached.etag)==-1)
+        return -1;
+    if(cached.last_modified[0]&&outvec_printf(request,
+        "If-Modified-Since: %s\r\n",cached.last_modified)==-1)
+        return -1;
+    return 1;
+}
+
+/*
+    tail_flight: write the block of flight to client as it is filled
+    return 0 when the whole response is written
+    return -1 when the fetch failed before the end of the response
+    return -2 when write to client error
+*/
+static int tail_flight(int clientfd, Flight_t* flight, Cache_t* block) {
+    size_t sent=0;
+    long n;
+
+    while((n=flight_tail(flight,sent))>(long)sent) {
+        if(rio_writen(clientfd,block->response+sent,n-sent)==-1)
+            return -2;
+        sent=n;
+    }
+    return n<0? -1 : 0;
+}
@@ -0,0 +1,50 @@
+/************************************************************
+	proxy.h
+	Definitions shared by the parts of the proxy
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include "csapp.h"
+#include "cache.h"
+#include "outvec.h"
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+/* flags for the request headers seen by rewrite_request_header */
+#define SEEN_HOST 0x1
+#define SEEN_USER_AGENT 0x2
+#define SEEN_CLOSE 0x4 // Connection: close
+#define SEEN_KEEP_ALIVE 0x8 // Connection: keep-alive
+#define SEEN_AUTHORIZATION 0x10 // the response is not cached
+#define SEEN_NO_CACHE 0x20 // Cache-Control or Pragma: no-cache
+
+/* the cache shared by all connections */
+extern Sharded_cache_t cache;
+
+/* serve the requests of one client connection, used by every threaded
+   server */
+void serve_client(int clientfd);
+
+/* request helpers shared by the threaded and event-driven servers */
+void clienterror(int fd, char *cause, char *errnum, 
+		 char *shortmsg, char *longmsg);
+int parse_request_line(char* buf, char* method, char* request_uri,
+	char* version);
+int parse_request_uri(char * request_uri, char* host, char* port,
+	char* query);
+int rewrite_request_header(char* buf, Outvec_t* out, int* seen);
+int finish_request_headers(Outvec_t* out, char* host, int seen,
+	int keep_alive);
+int modified_open_clientfd(char *hostname, char *port);
+
+/* print how requests were answered, for SIGUSR1 */
+void print_event_stats(void);
+
+#endif /* __PROXY_H__ */
@@ -0,0 +1,164 @@
+/************************************************************
+	refresh.c
+	Background refresh of cached responses
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+Once cached responses expire, the first request after the expiry used
+to wait for the server: the response was revalidated or fetched again
+while the client waited. Two things keep that wait away from clients.
+
+A block that expired less than its stale window ago is still sent
+(stale-while-revalidate): the window is the response's own
+stale-while-revalidate, or the one given with -S when it does not say,
+and none when it says no-cache, must-revalidate or proxy-revalidate.
+The first hit in the window queues a background refresh of the block.
+
+A hot block is refreshed before it expires at all: in the last tenth
+of its freshness lifetime (REFRESH_AHEAD_SHARE) the hits are counted,
+and once REFRESH_HOT_HITS arrive a refresh is queued while the block
+is still fresh.
+
+A small pool of refresher threads runs the queued refreshes through
+the proxy's own miss path (see refresh_response in proxy.c), which
+revalidates the block when it has validators, and writes the response
+to /dev/null instead of to a client. A block is queued at most once
+at a time, and a full queue drops the refresh: the block is then
+refreshed by a later hit, or by a client once its window is over.
+
+************************************************************/
+#include "csapp.h"
+#include "refresh.h"
+
+/*
+	One queued refresh
+*/
+struct refresh_job {
+    Cache_t* block; // held until the refresh is done
+    struct refresh_job* next;
+};
+
+static struct {
+    long stale_window; // seconds a block may be sent stale by default
+    refresh_fetch_t fetch;
+    int sinkfd; // /dev/null, the refreshed responses are written there
+    struct refresh_job *head,*tail; // refreshes waiting for a thread
+    int queued;
+    sem_t lock; // protects the queue
+    sem_t jobs; // number of refreshes in the queue
+} refresher;
+
+static void refresh_later(Cache_t* block);
+static void* refresher_thread(void* vargp);
+
+
+/*
+	init_refreshers: start the refresher threads, blocks may be sent
+	stale_window seconds after they expire unless they say otherwise
+*/
+void init_refreshers(long stale_window, refresh_fetch_t fetch) {
+    pthread_t tid;
+    int i;
+
+    refresher.stale_window=stale_window;
+    refresher.fetch=fetch;
+    refresher.sinkfd=Open("/dev/null", O_WRONLY, 0);
+    Sem_init(&refresher.lock, 0, 1);
+    Sem_init(&refresher.jobs, 0, 0);
+    for(i=0;i<REFRESHERS;i++)
+        Pthread_create(&tid, NULL, refresher_thread, NULL);
+}
+
+/*
+	set_freshness: block is fresh until expires, as decided at now,
+	and may be sent stale for stale seconds more (-1: the default
+	window). The block may be in the cache already, being revalidated.
+*/
+void set_freshness(Cache_t* block, time_t now, time_t expires, long stale) {
+    time_t lifetime=expires>now? expires-now : 0;
+
+    if(stale<0)
+        stale=refresher.stale_window;
+    __atomic_store_n(&block->hits, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&block->refresh_at,
+        expires-lifetime/REFRESH_AHEAD_SHARE, __ATOMIC_RELAXED);
+    __atomic_store_n(&block->stale_until, expires+stale, __ATOMIC_RELAXED);
+    __atomic_store_n(&block->expires, expires, __ATOMIC_RELAXED);
+}
+
+/*
+	refresh_hit: whether a hit on block at now may send it, and queue
+	its refresh when it is hot and about to expire, or already stale
+	return false when it has to be revalidated before it is sent
+*/
+bool refresh_hit(Cache_t* block, time_t now) {
+    if(now<__atomic_load_n(&block->expires, __ATOMIC_RELAXED)) {
+        if(now>=__atomic_load_n(&block->refresh_at, __ATOMIC_RELAXED)&&
+            __atomic_add_fetch(&block->hits, 1, __ATOMIC_RELAXED)
+            >=REFRESH_HOT_HITS)
+            refresh_later(block);
+        return true;
+    }
+    if(now<__atomic_load_n(&block->stale_until, __ATOMIC_RELAXED)) {
+        refresh_later(block);
+        return true;
+    }
+    return false;
+}
+
+
+/*
+	refresh_later: queue a refresh of block, unless one is queued or
+	running already, or the queue is full
+*/
+static void refresh_later(Cache_t* block) {
+    struct refresh_job* job;
+
+    if(__atomic_exchange_n(&block->refreshing, 1, __ATOMIC_ACQ_REL))
+        return;
+    P(&refresher.lock);
+    if(refresher.queued>=REFRESH_QUEUE_MAX) {
+        V(&refresher.lock);
+        __atomic_store_n(&block->refreshing, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    job=Malloc(sizeof(struct refresh_job));
+    hold_cache_block(block);
+    job->block=block;
+    job->next=NULL;
+    if(refresher.tail)
+        refresher.tail->next=job;
+    else
+        refresher.head=job;
+    refresher.tail=job;
+    refresher.queued++;
+    V(&refresher.lock);
+    V(&refresher.jobs);
+}
+
+/*
+	refresher_thread: run the queued refreshes
+*/
+static void* refresher_thread(void* vargp) {
+    struct refresh_job* job;
+
+    Pthread_detach(pthread_self());
+    while(1) {
+        P(&refresher.jobs);
+        P(&refresher.lock);
+        job=refresher.head;
+        refresher.head=job->next;
+        if(refresher.head==NULL)
+            refresher.tail=NULL;
+        refresher.queued--;
+        V(&refresher.lock);
+
+        refresher.fetch(job->block, refresher.sinkfd);
+        // a block that was revalidated may be refreshed again later,
+        // one that was replaced is no longer found
+        __atomic_store_n(&job->block->refreshing, 0, __ATOMIC_RELEASE);
+        release_cache_block(job->block);
+        Free(job);
+    }
+    return NULL;
+}
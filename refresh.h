@@ -0,0 +1,33 @@
+/************************************************************
+	refresh.h
+	Background refresh of cached responses
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __REFRESH_H__
+#define __REFRESH_H__
+
+#include <stdbool.h>
+#include <time.h>
+#include "cache.h"
+
+/* threads fetching the refreshed responses */
+#define REFRESHERS 2
+/* refreshes waiting for a thread at most, more are not queued */
+#define REFRESH_QUEUE_MAX 64
+/* hits that make a fresh block hot */
+#define REFRESH_HOT_HITS 8
+/* a hot block is refreshed in the last 1/REFRESH_AHEAD_SHARE of its
+   freshness lifetime */
+#define REFRESH_AHEAD_SHARE 10
+
+/* fetches block's url again, its response is written to sinkfd */
+typedef void (*refresh_fetch_t)(Cache_t* block, int sinkfd);
+
+void init_refreshers(long stale_window, refresh_fetch_t fetch);
+void set_freshness(Cache_t* block, time_t now, time_t expires, long stale);
+bool refresh_hit(Cache_t* block, time_t now);
+
+#endif /* __REFRESH_H__ */
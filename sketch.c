@@ -0,0 +1,136 @@
+/************************************************************
+	sketch.c
+	A count-min sketch of how often urls are asked for
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+The TinyLFU cache policy (see cache.c) admits a new block only when its
+url is asked for more often than the block it would evict, so it has
+to know how often urls are asked for, also the ones that are not
+cached. Keeping a count per url would take more memory than the cache;
+a count-min sketch keeps an estimate in a few small arrays instead.
+
+Each url is counted in one counter of every row, picked by bits of its
+hash, and the estimate is the smallest of its counters: urls sharing a
+counter can only make it larger, the row where it shares the least
+comes closest. Only the counters at the smallest value are incremented
+(conservative update), which keeps the shared ones from growing for
+nothing. A counter stops at SKETCH_MAX_COUNT, telling a hot url from a
+cold one takes no more.
+
+After SKETCH_SAMPLE_FACTOR additions per counter of a row every counter
+is halved, so a url that was popular once does not keep its place when
+it is no longer asked for.
+
+Lookups count without any lock, like the cache's readers: the counters
+are loaded and stored with relaxed atomic operations, and an increment
+that races with another one may be lost, which only makes an estimate
+a little low.
+
+************************************************************/
+#include "csapp.h"
+#include "sketch.h"
+
+static unsigned long sketch_mix(unsigned long hash);
+static void sketch_halve(Sketch_t* sketch);
+
+
+/*
+	new_sketch: a sketch with rows of about width counters, all zero
+*/
+Sketch_t* new_sketch(size_t width) {
+    Sketch_t* sketch=Malloc(sizeof(Sketch_t));
+    size_t w=SKETCH_MIN_WIDTH;
+
+    while(w<width&&w<SKETCH_MAX_WIDTH)
+        w<<=1;
+    sketch->width=w;
+    sketch->counters=Calloc(SKETCH_DEPTH*w,1);
+    sketch->additions=0;
+    sketch->sample=SKETCH_SAMPLE_FACTOR*(long)w;
+    return sketch;
+}
+
+/*
+	sketch_add: count one more request for the url of hash
+*/
+void sketch_add(Sketch_t* sketch, unsigned long hash) {
+    unsigned char* c[SKETCH_DEPTH];
+    int row,n,min=SKETCH_MAX_COUNT;
+
+    hash=sketch_mix(hash);
+    for(row=0;row<SKETCH_DEPTH;row++) {
+        c[row]=&sketch->counters[row*sketch->width
+            +((hash>>(row*16))&(sketch->width-1))];
+        n=__atomic_load_n(c[row], __ATOMIC_RELAXED);
+        if(n<min)
+            min=n;
+    }
+    if(min<SKETCH_MAX_COUNT) {
+        for(row=0;row<SKETCH_DEPTH;row++)
+            if(__atomic_load_n(c[row], __ATOMIC_RELAXED)==min)
+                __atomic_store_n(c[row], min+1, __ATOMIC_RELAXED);
+    }
+    // only the addition that reaches the sample halves the counters
+    if(__atomic_add_fetch(&sketch->additions, 1, __ATOMIC_RELAXED)
+        ==sketch->sample) {
+        sketch_halve(sketch);
+        __atomic_sub_fetch(&sketch->additions, sketch->sample/2,
+            __ATOMIC_RELAXED);
+    }
+}
+
+/*
+	sketch_estimate: about how many times the url of hash was asked for
+	lately, at most SKETCH_MAX_COUNT
+*/
+int sketch_estimate(Sketch_t* sketch, unsigned long hash) {
+    int row,n,min=SKETCH_MAX_COUNT;
+
+    hash=sketch_mix(hash);
+    for(row=0;row<SKETCH_DEPTH;row++) {
+        n=__atomic_load_n(&sketch->counters[row*sketch->width
+            +((hash>>(row*16))&(sketch->width-1))], __ATOMIC_RELAXED);
+        if(n<min)
+            min=n;
+    }
+    return min;
+}
+
+/*
+	free_sketch: free a sketch and its counters
+*/
+void free_sketch(Sketch_t* sketch) {
+    if(!sketch)
+        return;
+    Free(sketch->counters);
+    Free(sketch);
+}
+
+
+/*
+	sketch_mix: mix the bits of a url's hash, the cache already picks
+	shards and buckets by them. Each row picks its counter by its own
+	16 bits of the result.
+*/
+static unsigned long sketch_mix(unsigned long hash) {
+    hash^=hash>>33;
+    hash*=0xff51afd7ed558ccdUL;
+    hash^=hash>>33;
+    hash*=0xc4ceb9fe1a85ec53UL;
+    hash^=hash>>33;
+    return hash;
+}
+
+/*
+	sketch_halve: halve every counter, old requests count half
+*/
+static void sketch_halve(Sketch_t* sketch) {
+    size_t i;
+    unsigned char n;
+
+    for(i=0;i<SKETCH_DEPTH*sketch->width;i++) {
+        n=__atomic_load_n(&sketch->counters[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&sketch->counters[i], n>>1, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,41 @@
+/************************************************************
+	sketch.h
+	A count-min sketch of how often urls are asked for
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __SKETCH_H__
+#define __SKETCH_H__
+
+#include <stddef.h>
+
+/* rows of counters, each url is counted once in every row */
+#define SKETCH_DEPTH 4
+/* bounds on the counters in a row (powers of two) */
+#define SKETCH_MIN_WIDTH 256
+#define SKETCH_MAX_WIDTH 65536
+/* a counter stops at this count */
+#define SKETCH_MAX_COUNT 15
+/* the counters are halved after this many additions per counter in
+   a row, so old popularity fades */
+#define SKETCH_SAMPLE_FACTOR 10
+
+/*
+	The sketch: SKETCH_DEPTH rows of width small counters
+*/
+struct sketch {
+    size_t width; // counters in a row (power of two)
+    unsigned char* counters; // the rows, one after the other
+    long additions; // since the counters were last halved
+    long sample; // additions that make the counters halve
+};
+typedef struct sketch  Sketch_t;
+
+Sketch_t* new_sketch(size_t width);
+void sketch_add(Sketch_t* sketch, unsigned long hash);
+int sketch_estimate(Sketch_t* sketch, unsigned long hash);
+void free_sketch(Sketch_t* sketch);
+
+#endif /* __SKETCH_H__ */
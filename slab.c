@@ -0,0 +1,337 @@
+/************************************************************
+	slab.c
+	A slab allocator for the cache blocks
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+A cache block used to be three malloc calls (the block, the url and
+the response) and three frees, so every insert and eviction went
+through malloc's locks and the heap was cut into pieces of every
+size. Now a block is one chunk from an arena allocated once.
+
+The arena is cut into slabs of SLAB_SIZE. A slab is given to one size
+class when it is needed and cut into chunks of that size; the classes
+grow by a quarter from SLAB_MIN_CHUNK up to SLAB_SIZE, so a chunk is
+at most a quarter larger than what it holds. A slab whose chunks are
+all free again goes back to the arena, so a class that is not used
+any more does not keep its slabs. Each thread also keeps up to
+SLAB_CACHE_BYTES of small free chunks of its own, so the common small
+blocks are taken and given back without the arena's lock.
+
+The arena bounds the memory of the cache. It has the slabs of the
+cache's budget, one more slab per size class for the ones partly
+used, and SLAB_INFLIGHT_RESERVE for the blocks being filled and the
+evicted ones still being written to clients. The shards are charged
+the size of their blocks' chunks (slab_chunk_size), not that of the
+responses, so what they hold fits in the budget. When the arena has
+no chunk left slab_alloc fails, and the response is not cached.
+Without an arena (a cache made by init_cache alone) malloc is used.
+
+************************************************************/
+#include "csapp.h"
+#include "slab.h"
+
+/* upper bound on the number of size classes */
+#define MAX_SLAB_CLASSES 64
+
+/*
+	One slab of the arena
+*/
+struct slab {
+    int class; // its size class, -1 when the slab is free
+    int used; // chunks given out
+    int carved; // chunks cut so far, the rest were never used
+    void* free; // chunks given back, linked through their first word
+    int prev,next; // neighbours in the class's list of slabs with room
+};
+
+static struct {
+    char* base; // NULL when there is no arena
+    int nslabs;
+    struct slab* slabs;
+    int* empty; // free slabs
+    int nempty;
+    size_t chunk[MAX_SLAB_CLASSES]; // chunk size of each class
+    int nchunks[MAX_SLAB_CLASSES]; // chunks in a slab of each class
+    int partial[MAX_SLAB_CLASSES]; // first slab with room, -1 if none
+    int nclasses;
+    sem_t lock; // protects all of the above
+} arena;
+
+/*
+	The free chunks a thread keeps
+*/
+struct thread_cache {
+    void* chunks[MAX_SLAB_CLASSES]; // linked through their first word
+    size_t bytes;
+};
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_once=PTHREAD_ONCE_INIT;
+
+/* counters for print_slab_stats */
+static struct {
+    long allocs; // chunks given out
+    long failures; // requests the arena had no chunk for
+} stats;
+
+static int size_class(size_t size);
+static void arena_free(void* p);
+static struct thread_cache* thread_cache(void);
+static void flush_thread_cache(void* vargp);
+static void make_key(void);
+static void list_remove(int s);
+static void list_push(int s);
+
+
+/*
+	init_slab_arena: set up the size classes and allocate an arena for
+	a cache of size bytes, cut into slabs: size, one slab per class
+	and SLAB_INFLIGHT_RESERVE
+*/
+void init_slab_arena(size_t size) {
+    size_t chunk;
+    int i;
+
+    if(arena.base!=NULL)
+        return;
+    for(chunk=SLAB_MIN_CHUNK;arena.nclasses<MAX_SLAB_CLASSES;) {
+        arena.chunk[arena.nclasses]=chunk;
+        arena.nchunks[arena.nclasses]=SLAB_SIZE/chunk;
+        arena.partial[arena.nclasses]=-1;
+        arena.nclasses++;
+        if(chunk==SLAB_SIZE)
+            break;
+        // a quarter larger, kept a multiple of 16 for alignment
+        chunk=(chunk+chunk/4+15)&~(size_t)15;
+        if(chunk>SLAB_SIZE)
+            chunk=SLAB_SIZE;
+    }
+
+    arena.nslabs=(size+SLAB_INFLIGHT_RESERVE+SLAB_SIZE-1)/SLAB_SIZE+
+        arena.nclasses;
+    arena.slabs=Malloc(arena.nslabs*sizeof(struct slab));
+    arena.empty=Malloc(arena.nslabs*sizeof(int));
+    for(i=0;i<arena.nslabs;i++) {
+        arena.slabs[i].class=-1;
+        arena.empty[i]=arena.nslabs-1-i;
+    }
+    arena.nempty=arena.nslabs;
+    Sem_init(&arena.lock,0,1);
+    arena.base=Malloc((size_t)arena.nslabs*SLAB_SIZE);
+}
+
+/*
+	slab_alloc: a chunk of at least size bytes, from malloc when there
+	is no arena
+	return NULL when the arena has no chunk left for size
+*/
+void* slab_alloc(size_t size) {
+    struct thread_cache* tc;
+    struct slab* sl;
+    void* p=NULL;
+    int c,s;
+
+    if(arena.base==NULL)
+        return Malloc(size);
+    if(size<=SLAB_SIZE) {
+        c=size_class(size);
+        if(size<=SLAB_CACHE_MAX_CHUNK&&(tc=thread_cache())!=NULL&&
+            tc->chunks[c]!=NULL) {
+            p=tc->chunks[c];
+            tc->chunks[c]=*(void**)p;
+            tc->bytes-=arena.chunk[c];
+            __atomic_fetch_add(&stats.allocs,1,__ATOMIC_RELAXED);
+            return p;
+        }
+        P(&arena.lock);
+        if((s=arena.partial[c])<0&&arena.nempty>0) {
+            s=arena.empty[--arena.nempty];
+            sl=&arena.slabs[s];
+            sl->class=c;
+            sl->used=0;
+            sl->carved=0;
+            sl->free=NULL;
+            list_push(s);
+        }
+        if(s>=0) {
+            sl=&arena.slabs[s];
+            if(sl->free) {
+                p=sl->free;
+                sl->free=*(void**)p;
+            }
+            else
+                p=arena.base+(size_t)s*SLAB_SIZE+sl->carved++*arena.chunk[c];
+            if(++sl->used==arena.nchunks[c])
+                list_remove(s);
+        }
+        V(&arena.lock);
+    }
+    if(p==NULL) {
+        __atomic_fetch_add(&stats.failures,1,__ATOMIC_RELAXED);
+        return NULL;
+    }
+    __atomic_fetch_add(&stats.allocs,1,__ATOMIC_RELAXED);
+    return p;
+}
+
+/*
+	slab_chunk_size: the bytes slab_alloc takes for size bytes, the
+	size of the chunk it gives (size itself when there is no arena)
+*/
+size_t slab_chunk_size(size_t size) {
+    if(arena.base==NULL||size>SLAB_SIZE)
+        return size;
+    return arena.chunk[size_class(size)];
+}
+
+/*
+	slab_free: give back a chunk of slab_alloc
+*/
+void slab_free(void* p) {
+    struct thread_cache* tc;
+    size_t chunk;
+    int c;
+
+    if(arena.base==NULL||(char*)p<arena.base||
+        (char*)p>=arena.base+(size_t)arena.nslabs*SLAB_SIZE) {
+        Free(p);
+        return;
+    }
+    // the slab keeps its class while p is given out
+    c=arena.slabs[((char*)p-arena.base)/SLAB_SIZE].class;
+    chunk=arena.chunk[c];
+    if(chunk<=SLAB_CACHE_MAX_CHUNK&&(tc=thread_cache())!=NULL&&
+        tc->bytes+chunk<=SLAB_CACHE_BYTES) {
+        *(void**)p=tc->chunks[c];
+        tc->chunks[c]=p;
+        tc->bytes+=chunk;
+        return;
+    }
+    arena_free(p);
+}
+
+/*
+	print_slab_stats: print the allocation counters, only uses the
+	async-signal-safe sio functions
+*/
+void print_slab_stats(void) {
+    sio_puts("slab: allocs=");
+    sio_putl(__atomic_load_n(&stats.allocs,__ATOMIC_RELAXED));
+    sio_puts(" failures=");
+    sio_putl(__atomic_load_n(&stats.failures,__ATOMIC_RELAXED));
+    sio_puts(" free_slabs=");
+    sio_putl(arena.nempty);
+    sio_puts("/");
+    sio_putl(arena.nslabs);
+    sio_puts("\n");
+}
+
+
+/*
+	arena_free: give a chunk back to its slab
+*/
+static void arena_free(void* p) {
+    struct slab* sl;
+    int s;
+
+    s=((char*)p-arena.base)/SLAB_SIZE;
+    sl=&arena.slabs[s];
+    P(&arena.lock);
+    *(void**)p=sl->free;
+    sl->free=p;
+    if(sl->used--==arena.nchunks[sl->class])
+        list_push(s); // it was full, it has room again
+    if(sl->used==0) {
+        list_remove(s);
+        sl->class=-1;
+        arena.empty[arena.nempty++]=s;
+    }
+    V(&arena.lock);
+}
+
+/*
+	thread_cache: the chunk cache of this thread, made the first time
+	return NULL when it cannot be made
+*/
+static struct thread_cache* thread_cache(void) {
+    struct thread_cache* tc;
+
+    pthread_once(&cache_once,make_key);
+    if((tc=pthread_getspecific(cache_key))!=NULL)
+        return tc;
+    if((tc=calloc(1,sizeof(struct thread_cache)))==NULL)
+        return NULL;
+    pthread_setspecific(cache_key,tc);
+    return tc;
+}
+
+/*
+	flush_thread_cache: give the chunks of a thread back to the arena,
+	the destructor run when the thread ends
+*/
+static void flush_thread_cache(void* vargp) {
+    struct thread_cache* tc=vargp;
+    void* p;
+    int c;
+
+    for(c=0;c<arena.nclasses;c++) {
+        while((p=tc->chunks[c])!=NULL) {
+            tc->chunks[c]=*(void**)p;
+            arena_free(p);
+        }
+    }
+    free(tc);
+}
+
+/*
+	make_key: make the key of the thread caches, once
+*/
+static void make_key(void) {
+    pthread_key_create(&cache_key,flush_thread_cache);
+}
+
+/*
+	size_class: the smallest class whose chunks hold size bytes
+*/
+static int size_class(size_t size) {
+    int lo=0,hi=arena.nclasses-1,mid;
+
+    while(lo<hi) {
+        mid=(lo+hi)/2;
+        if(arena.chunk[mid]>=size)
+            hi=mid;
+        else
+            lo=mid+1;
+    }
+    return lo;
+}
+
+/*
+	list_remove: take slab s out of its class's list of slabs with
+	room. Called with the lock held.
+*/
+static void list_remove(int s) {
+    struct slab* sl=&arena.slabs[s];
+
+    if(sl->prev>=0)
+        arena.slabs[sl->prev].next=sl->next;
+    else
+        arena.partial[sl->class]=sl->next;
+    if(sl->next>=0)
+        arena.slabs[sl->next].prev=sl->prev;
+}
+
+/*
+	list_push: put slab s at the front of its class's list of slabs
+	with room. Called with the lock held.
+*/
+static void list_push(int s) {
+    struct slab* sl=&arena.slabs[s];
+
+    sl->prev=-1;
+    sl->next=arena.partial[sl->class];
+    if(sl->next>=0)
+        arena.slabs[sl->next].prev=s;
+    arena.partial[sl->class]=s;
+}
@@ -0,0 +1,34 @@
+/************************************************************
+	slab.h
+	A slab allocator for the cache blocks
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* size of a slab, every chunk of one slab has the same size class */
+#define SLAB_SIZE (128*1024)
+/* smallest size class */
+#define SLAB_MIN_CHUNK 128
+/* the arena has this much room besides the cache's budget, for the
+   blocks being filled, the evicted blocks still being written to
+   clients and the chunks the threads keep */
+#define SLAB_INFLIGHT_RESERVE (4*1024*1024)
+/* chunks up to this size are also kept in a per-thread cache */
+#define SLAB_CACHE_MAX_CHUNK 4096
+/* bytes of free chunks one thread may keep */
+#define SLAB_CACHE_BYTES (32*1024)
+
+void init_slab_arena(size_t size);
+void* slab_alloc(size_t size);
+size_t slab_chunk_size(size_t size);
+void slab_free(void* p);
+void print_slab_stats(void);
+
+#endif /* __SLAB_H__ */
@@ -0,0 +1,548 @@
+/************************************************************
+	store.c
+	A persistent cache store in a memory-mapped file
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+The memory cache is lost when the proxy stops, and a restarted proxy
+has to fetch every object again. With -c, every object put into the
+memory cache is also written to a file that is mapped into memory,
+and a restarted proxy maps the same file and serves what is in it at
+once. The file is a header, a table of index slots and a data region
+used as a ring: records are written one after the other, and when the
+region is full the oldest records are overwritten, so the store keeps
+the most recently fetched objects.
+
+Starting up only reads the slot table, not the data, so it takes
+milliseconds even for a large file. A record is checked against the
+checksum in its slot the first time it is used: a slot written but
+whose data was not (the proxy or the machine went down in between)
+fails the check and is dropped. A slot is only marked used after its
+data and checksum are written, and cleared before its data is
+overwritten.
+
+One lock protects the index. A client being sent a record holds it,
+and a record that is held is never overwritten: the insert that would
+need its space is skipped instead. An insert only takes the lock to
+reserve a slot and the space, which it holds while it copies the
+record in without the lock, and again to publish the slot; the
+records' order (seq) is the order their space was reserved in, which
+is the order of the ring.
+
+************************************************************/
+#include <stdint.h>
+#include <time.h>
+#include "cache.h"
+#include "http.h"
+#include "refresh.h"
+#include "proxy.h"
+#include "store.h"
+
+#define STORE_MAGIC 0x31524f5453585250ULL /* "PRXSTOR1" */
+#define STORE_VERSION 1
+#define STORE_PAGE 4096
+
+/*
+	The header at the start of the file
+*/
+struct store_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t nslots;
+    uint64_t file_size;
+    uint64_t data_offset; // where the data region starts
+    uint64_t data_size;
+};
+
+/*
+	An index slot in the file. A record is the url followed by the
+	response, at offset in the data region.
+*/
+struct store_slot {
+    uint64_t seq; // order the records were written in, 0 when unused
+    uint64_t offset;
+    uint64_t hash; // cache_hash of the url
+    uint32_t url_len;
+    uint32_t response_len;
+    uint32_t keeps_alive;
+    uint32_t unused;
+    uint64_t checksum; // of the fields from offset on and the record
+};
+
+/*
+	What is only kept in memory about a slot
+*/
+struct slot_state {
+    int next; // next slot in the same bucket, -1 at the end
+    int readers; // clients being sent the record
+    bool live; // in the index
+    bool verified; // the record matched its checksum
+};
+
+static struct {
+    char* map;
+    struct store_header* header;
+    struct store_slot* slots;
+    char* data;
+    int nslots;
+    uint64_t data_size;
+    uint64_t head; // where the next record is written
+    uint64_t seq; // seq of the newest record
+    struct slot_state* state;
+    int* buckets; // first slot of each bucket, -1 when empty
+    int nbuckets; // power of two
+    int* fifo; // slots in the order their records were written
+    int fifo_first,fifo_count;
+    int* free_slots; // slots that are in neither the index nor fifo
+    int nfree;
+    sem_t lock; // protects all of the above but the mapped data
+} store;
+
+static bool open_store_file(char* path, long size);
+static void load_index(void);
+static void warm_memory_cache(void);
+static int find_slot(char* url, size_t url_len, unsigned long hash);
+static void add_to_index(int i);
+static void drop_from_index(int i);
+static bool pop_oldest(void);
+static int take_free_slot(void);
+static long reserve(uint64_t len);
+static bool verify_slot(int i);
+static uint64_t record_checksum(struct store_slot* s);
+static int compare_seq(const void* a, const void* b);
+
+
+/*
+	init_store: keep the cached objects in the file at path, made
+	size bytes long when it is new; what an earlier run left in it is
+	served at once, and the newest part copied into the memory cache
+	return -1 when the file cannot be used
+*/
+int init_store(char* path, long size) {
+    struct timeval start,end;
+    int i;
+
+    gettimeofday(&start,NULL);
+    if(!open_store_file(path,size))
+        return -1;
+    Sem_init(&store.lock,0,1);
+    store.nslots=store.header->nslots;
+    store.data_size=store.header->data_size;
+    store.slots=(struct store_slot*)(store.map+sizeof(struct store_header));
+    store.data=store.map+store.header->data_offset;
+    store.state=Calloc(store.nslots,sizeof(struct slot_state));
+    for(store.nbuckets=1;store.nbuckets<store.nslots;store.nbuckets<<=1)
+        ;
+    store.buckets=Malloc(store.nbuckets*sizeof(int));
+    for(i=0;i<store.nbuckets;i++)
+        store.buckets[i]=-1;
+    store.fifo=Malloc(store.nslots*sizeof(int));
+    store.free_slots=Malloc(store.nslots*sizeof(int));
+
+    load_index();
+    warm_memory_cache();
+    gettimeofday(&end,NULL);
+    printf("store %s: %d objects in %ld MB, started in %.1f ms\n",path,
+        store.fifo_count,(long)(store.header->file_size>>20),
+        (end.tv_sec-start.tv_sec)*1000.0+(end.tv_usec-start.tv_usec)/1000.0);
+    return 0;
+}
+
+/*
+	store_enabled: whether the store is on
+*/
+bool store_enabled(void) {
+    return store.map!=NULL;
+}
+
+/*
+	store_lookup: find the object of url, it is held until
+	store_release
+	return false when it is not in the store
+*/
+bool store_lookup(char* url, Store_hit_t* hit) {
+    unsigned long hash=cache_hash(url);
+    struct store_slot* s;
+    int i;
+
+    P(&store.lock);
+    if((i=find_slot(url,strlen(url),hash))<0) {
+        V(&store.lock);
+        return false;
+    }
+    store.state[i].readers++;
+    V(&store.lock);
+
+    // a record is read the first time outside the lock, it is held
+    if(!store.state[i].verified&&!verify_slot(i)) {
+        P(&store.lock);
+        store.state[i].readers--;
+        if(store.state[i].live)
+            drop_from_index(i);
+        V(&store.lock);
+        fprintf(stderr, "store: dropped a torn object of %s\n",url);
+        return false;
+    }
+    s=&store.slots[i];
+    hit->slot=i;
+    hit->response=store.data+s->offset+s->url_len;
+    hit->size=s->response_len;
+    hit->keeps_alive=s->keeps_alive;
+    return true;
+}
+
+/*
+	store_release: done with a hit of store_lookup
+*/
+void store_release(Store_hit_t* hit) {
+    P(&store.lock);
+    store.state[hit->slot].readers--;
+    V(&store.lock);
+}
+
+/*
+	store_insert: write an object into the store, in place of an older
+	object of the same url. Skipped when its space is still being sent
+	to a client.
+*/
+void store_insert(char* url, char* response, size_t size,
+	bool keeps_alive) {
+    unsigned long hash=cache_hash(url);
+    size_t url_len=strlen(url);
+    uint64_t len=url_len+size,seq;
+    struct store_slot* s;
+    long offset;
+    int i,k;
+
+    if(size==0||size>=MAX_OBJECT_SIZE||url_len>=MAXLINE||
+        len>store.data_size/2)
+        return;
+    // take a slot and the space, held so nobody overwrites them
+    P(&store.lock);
+    if((i=take_free_slot())<0||(offset=reserve(len))<0) {
+        if(i>=0)
+            store.free_slots[store.nfree++]=i;
+        V(&store.lock);
+        return;
+    }
+    seq=++store.seq;
+    store.state[i].readers=1;
+    store.fifo[(store.fifo_first+store.fifo_count)%store.nslots]=i;
+    store.fifo_count++;
+    V(&store.lock);
+
+    // the copy and the checksum need no lock, the slot is not used yet
+    s=&store.slots[i];
+    memcpy(store.data+offset,url,url_len);
+    memcpy(store.data+offset+url_len,response,size);
+    s->offset=offset;
+    s->hash=hash;
+    s->url_len=url_len;
+    s->response_len=size;
+    s->keeps_alive=keeps_alive;
+    s->checksum=record_checksum(s);
+
+    // publish it, unless a newer insert of the url got there first
+    P(&store.lock);
+    store.state[i].readers=0;
+    if((k=find_slot(url,url_len,hash))>=0) {
+        if(store.slots[k].seq>seq) {
+            V(&store.lock);
+            return;
+        }
+        drop_from_index(k);
+    }
+    // the slot is used only once everything it covers is written
+    __atomic_store_n(&s->seq,seq,__ATOMIC_RELEASE);
+    store.state[i].verified=true;
+    add_to_index(i);
+    V(&store.lock);
+}
+
+
+/*
+	open_store_file: map the store file at path, a missing or foreign
+	file is made into an empty store of size bytes
+	return false when it cannot be
+*/
+static bool open_store_file(char* path, long size) {
+    struct store_header* h;
+    struct stat st;
+    uint64_t nslots,data_offset;
+    int fd;
+
+    if((fd=open(path,O_RDWR|O_CREAT,0600))<0||fstat(fd,&st)<0)
+        return false;
+    if(st.st_size>=(off_t)sizeof(struct store_header)) {
+        store.map=mmap(NULL,st.st_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+        if(store.map==MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        h=(struct store_header*)store.map;
+        if(h->magic==STORE_MAGIC&&h->version==STORE_VERSION&&
+            h->file_size==(uint64_t)st.st_size&&
+            h->data_offset>=sizeof(struct store_header)+
+                h->nslots*sizeof(struct store_slot)&&
+            h->data_offset+h->data_size==h->file_size&&h->nslots>0) {
+            store.header=h;
+            close(fd);
+            return true;
+        }
+        munmap(store.map,st.st_size);
+        fprintf(stderr, "store: %s is not a store, made empty\n",path);
+    }
+
+    // a new store: the slots are all zero, so unused
+    nslots=size/STORE_SLOT_SHARE;
+    data_offset=sizeof(struct store_header)+nslots*sizeof(struct store_slot);
+    data_offset=(data_offset+STORE_PAGE-1)/STORE_PAGE*STORE_PAGE;
+    if(nslots==0||data_offset>=size||ftruncate(fd,0)<0||
+        ftruncate(fd,size)<0) {
+        close(fd);
+        return false;
+    }
+    store.map=mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if(store.map==MAP_FAILED)
+        return false;
+    h=(struct store_header*)store.map;
+    h->version=STORE_VERSION;
+    h->nslots=nslots;
+    h->file_size=size;
+    h->data_offset=data_offset;
+    h->data_size=size-data_offset;
+    __atomic_store_n(&h->magic,STORE_MAGIC,__ATOMIC_RELEASE);
+    store.header=h;
+    return true;
+}
+
+/*
+	load_index: put the used slots into the index and the fifo, oldest
+	first, and carry on writing after the newest record. A slot that
+	points outside the data is cleared; of two slots with the same
+	url the older one is. The urls are only read when two slots have
+	the same hash.
+*/
+static void load_index(void) {
+    struct store_slot* s;
+    int i,j,k,n=0;
+
+    for(i=0;i<store.nslots;i++) {
+        s=&store.slots[i];
+        if(s->seq==0) {
+            store.free_slots[store.nfree++]=i;
+            continue;
+        }
+        if(s->url_len==0||s->url_len>=MAXLINE||s->response_len==0||
+            s->response_len>=MAX_OBJECT_SIZE||s->offset>store.data_size||
+            s->url_len+s->response_len>store.data_size-s->offset) {
+            s->seq=0;
+            store.free_slots[store.nfree++]=i;
+            continue;
+        }
+        store.fifo[n++]=i;
+    }
+    qsort(store.fifo,n,sizeof(int),compare_seq);
+
+    store.fifo_first=0;
+    store.fifo_count=n;
+    for(j=0;j<n;j++) {
+        i=store.fifo[j];
+        s=&store.slots[i];
+        if((k=find_slot(store.data+s->offset,s->url_len,s->hash))>=0)
+            drop_from_index(k);
+        add_to_index(i);
+        store.seq=s->seq;
+        store.head=s->offset+s->url_len+s->response_len;
+    }
+}
+
+/*
+	warm_memory_cache: copy the newest objects that fit into the
+	memory cache, so the first hits on them do not need the store.
+	Objects that are no longer fresh are left in the store.
+*/
+static void warm_memory_cache(void) {
+    struct store_slot* s;
+    Cache_t* block;
+    char url[MAXLINE];
+    long total=0;
+    time_t now=time(NULL),expires;
+    long stale;
+    int i,j;
+
+    // find the oldest of the newest records that fit, copy from there
+    for(j=store.fifo_count;j>0;j--) {
+        i=store.fifo[(store.fifo_first+j-1)%store.nslots];
+        if(total+store.slots[i].response_len>MAX_CACHE_SIZE)
+            break;
+        total+=store.slots[i].response_len;
+    }
+    for(;j<store.fifo_count;j++) {
+        i=store.fifo[(store.fifo_first+j)%store.nslots];
+        s=&store.slots[i];
+        if(!store.state[i].live||!verify_slot(i)) {
+            if(store.state[i].live)
+                drop_from_index(i);
+            continue;
+        }
+        expires=stored_response_expires(store.data+s->offset+s->url_len,
+            s->response_len,now,&stale);
+        if(expires<=now)
+            continue;
+        memcpy(url,store.data+s->offset,s->url_len);
+        url[s->url_len]='\0';
+        block=construct_cache_block(url,store.data+s->offset+s->url_len,
+            s->response_len);
+        if(block==NULL)
+            break; // the slab arena is full
+        block->keeps_alive=s->keeps_alive;
+        set_freshness(block,now,expires,stale);
+        insert_to_shard(block,select_shard(block->hash,&cache));
+    }
+}
+
+/*
+	find_slot: the slot in the index with the url_len bytes of url
+	and their hash
+	return -1 when there is none. Called with the lock held.
+*/
+static int find_slot(char* url, size_t url_len, unsigned long hash) {
+    struct store_slot* s;
+    int i;
+
+    for(i=store.buckets[hash&(store.nbuckets-1)];i>=0;i=store.state[i].next) {
+        s=&store.slots[i];
+        if(s->hash==hash&&s->url_len==url_len&&
+            !memcmp(store.data+s->offset,url,url_len))
+            return i;
+    }
+    return -1;
+}
+
+/*
+	add_to_index: add slot i to its bucket. Called with the lock held.
+*/
+static void add_to_index(int i) {
+    int* bucket=&store.buckets[store.slots[i].hash&(store.nbuckets-1)];
+
+    store.state[i].next=*bucket;
+    store.state[i].live=true;
+    *bucket=i;
+}
+
+/*
+	drop_from_index: take slot i out of the index and clear it in the
+	file. It stays in the fifo, its space is reused once it is the
+	oldest. Called with the lock held.
+*/
+static void drop_from_index(int i) {
+    int* link=&store.buckets[store.slots[i].hash&(store.nbuckets-1)];
+
+    while(*link!=i)
+        link=&store.state[*link].next;
+    *link=store.state[i].next;
+    store.state[i].live=false;
+    store.state[i].verified=false;
+    __atomic_store_n(&store.slots[i].seq,0,__ATOMIC_RELEASE);
+}
+
+/*
+	pop_oldest: free the slot of the oldest record and its space
+	return false when a client is still being sent it. Called with
+	the lock held.
+*/
+static bool pop_oldest(void) {
+    int i=store.fifo[store.fifo_first];
+
+    if(store.state[i].readers>0)
+        return false;
+    if(store.state[i].live)
+        drop_from_index(i);
+    store.fifo_first=(store.fifo_first+1)%store.nslots;
+    store.fifo_count--;
+    store.free_slots[store.nfree++]=i;
+    return true;
+}
+
+/*
+	take_free_slot: a slot for a new record, the oldest record gives
+	up its slot when there is no free one
+	return -1 when none can be had. Called with the lock held.
+*/
+static int take_free_slot(void) {
+    if(store.nfree==0&&(store.fifo_count==0||!pop_oldest()))
+        return -1;
+    return store.free_slots[--store.nfree];
+}
+
+/*
+	reserve: find len bytes for a new record at the head of the ring,
+	the records in the way are the oldest and are freed
+	return the offset, -1 when a record in the way is being sent.
+	Called with the lock held.
+*/
+static long reserve(uint64_t len) {
+    struct store_slot* s;
+
+    if(store.head+len>store.data_size) {
+        // too little room before the end: the records there are the
+        // oldest, the ring starts over
+        while(store.fifo_count>0&&
+            store.slots[store.fifo[store.fifo_first]].offset>=store.head) {
+            if(!pop_oldest())
+                return -1;
+        }
+        store.head=0;
+    }
+    while(store.fifo_count>0) {
+        s=&store.slots[store.fifo[store.fifo_first]];
+        if(s->offset>=store.head+len||
+            s->offset+s->url_len+s->response_len<=store.head)
+            break;
+        if(!pop_oldest())
+            return -1;
+    }
+    store.head+=len;
+    return store.head-len;
+}
+
+/*
+	verify_slot: whether the record of slot i matches its checksum,
+	remembered once it does
+*/
+static bool verify_slot(int i) {
+    if(record_checksum(&store.slots[i])!=store.slots[i].checksum)
+        return false;
+    store.state[i].verified=true;
+    return true;
+}
+
+/*
+	record_checksum: FNV-1a of the slot's fields from offset on and
+	of the record they point to
+*/
+static uint64_t record_checksum(struct store_slot* s) {
+    uint64_t h=0xcbf29ce484222325ULL;
+    unsigned char* p=(unsigned char*)&s->offset;
+    unsigned char* end=(unsigned char*)&s->checksum;
+
+    while(p<end)
+        h=(h^*p++)*0x100000001b3ULL;
+    p=(unsigned char*)store.data+s->offset;
+    end=p+s->url_len+s->response_len;
+    while(p<end)
+        h=(h^*p++)*0x100000001b3ULL;
+    return h;
+}
+
+/*
+	compare_seq: qsort order of slot numbers, oldest record first
+*/
+static int compare_seq(const void* a, const void* b) {
+    uint64_t x=store.slots[*(const int*)a].seq;
+    uint64_t y=store.slots[*(const int*)b].seq;
+
+    return x<y? -1 : x>y;
+}
@@ -0,0 +1,38 @@
+/************************************************************
+	store.h
+	A persistent cache store in a memory-mapped file
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* default size of a new store file, in megabytes */
+#define DEFAULT_STORE_MB 64
+/* one index slot per this many bytes of the store file */
+#define STORE_SLOT_SHARE 8192
+
+/*
+	An object found in the store. The response points into the
+	mapped file, it stays there until store_release.
+*/
+struct store_hit {
+    int slot;
+    char* response;
+    size_t size;
+    bool keeps_alive;
+};
+typedef struct store_hit  Store_hit_t;
+
+int init_store(char* path, long size);
+bool store_enabled(void);
+bool store_lookup(char* url, Store_hit_t* hit);
+void store_release(Store_hit_t* hit);
+void store_insert(char* url, char* response, size_t size, bool keeps_alive);
+
+#endif /* __STORE_H__ */
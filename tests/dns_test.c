@@ -0,0 +1,179 @@
+/************************************************************
+	dns_test.c
+	The resolver caches, coalesces and forgets its answers
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+Runs dns.c with a stand-in for getaddrinfo, so nothing goes to the
+network: "localhost" is handed to the real getaddrinfo, which finds
+it in /etc/hosts, "slow.test" is answered with 127.0.0.1 after
+SLOW_LOOKUP_MS, and every other name fails with EAI_NONAME. The
+stand-in counts its calls per name, and the test checks that
+
+    a second lookup of a known name is answered from the table;
+    CONCURRENT_LOOKUPS threads missing the same name share one call;
+    dns_resolve calls back for an unknown name, and answers at once
+    (without calling back) once the name is known;
+    a failed lookup is remembered, and tried again once
+    DNS_NEGATIVE_TTL seconds have passed;
+    the address family that connected last is remembered per name.
+
+usage: tests/dns_test
+exits 0 when the test passes
+
+************************************************************/
+#include <stdbool.h>
+#include "csapp.h"
+#include "dns.h"
+
+#define SLOW_LOOKUP_MS 200
+#define CONCURRENT_LOOKUPS 16
+
+enum { LOCALHOST, SLOW, OTHER, NAMES };
+
+static int calls[NAMES]; // lookups run by the stand-in, per name
+static sem_t called_back; // posted by resolved
+static Dns_result_t* callback_result; // what resolved was given
+
+static int fake_getaddrinfo(const char* host, const char* port,
+	const struct addrinfo* hints, struct addrinfo** addrs);
+static void* lookup_thread(void* vargp);
+static void resolved(void* arg, Dns_result_t* result);
+static bool has_loopback(Dns_result_t* result);
+static void fail(char* msg);
+
+
+int main(void) {
+    Dns_result_t *first,*second,*results[CONCURRENT_LOOKUPS];
+    pthread_t tids[CONCURRENT_LOOKUPS];
+    int i;
+
+    Sem_init(&called_back, 0, 0);
+    init_dns(fake_getaddrinfo);
+
+    // a name from /etc/hosts, then the same name from the table
+    first=dns_lookup("localhost","80");
+    if(first->error||!has_loopback(first))
+        fail("localhost has no loopback address");
+    second=dns_lookup("localhost","80");
+    if(second!=first||calls[LOCALHOST]!=1)
+        fail("the second lookup of localhost was not a hit");
+    dns_release(first);
+    dns_release(second);
+
+    // many misses of one name while it is being looked up
+    for(i=0;i<CONCURRENT_LOOKUPS;i++)
+        Pthread_create(&tids[i],NULL,lookup_thread,&results[i]);
+    for(i=0;i<CONCURRENT_LOOKUPS;i++)
+        Pthread_join(tids[i],NULL);
+    if(calls[SLOW]!=1)
+        fail("concurrent misses were not coalesced");
+    for(i=0;i<CONCURRENT_LOOKUPS;i++) {
+        if(results[i]->error||!has_loopback(results[i]))
+            fail("a coalesced lookup got no address");
+        dns_release(results[i]);
+    }
+
+    // the event loops' form: a callback for a miss, none for a hit
+    if(dns_resolve("slow.test","443",resolved,NULL)!=NULL)
+        fail("a new port was answered without a lookup");
+    P(&called_back);
+    if(callback_result->error||calls[SLOW]!=2)
+        fail("the callback did not get the answer");
+    dns_release(callback_result);
+    if((first=dns_resolve("slow.test","443",resolved,NULL))==NULL)
+        fail("a known name was not answered at once");
+    dns_release(first);
+
+    // a failure is remembered, but not for long
+    first=dns_lookup("no.such.test","80");
+    if(first->error!=EAI_NONAME||first->addrs)
+        fail("an unknown name did not fail");
+    dns_release(first);
+    first=dns_lookup("no.such.test","80");
+    if(first->error!=EAI_NONAME||calls[OTHER]!=1)
+        fail("a failed lookup was not remembered");
+    dns_release(first);
+    sleep(DNS_NEGATIVE_TTL+1);
+    first=dns_lookup("no.such.test","80");
+    if(calls[OTHER]!=2)
+        fail("a failed lookup was remembered too long");
+    dns_release(first);
+
+    // the family that connected is tried first next time
+    if(dns_preferred_family("localhost","80")!=AF_UNSPEC)
+        fail("a family was preferred before one connected");
+    dns_remember_family("localhost","80",AF_INET6);
+    if(dns_preferred_family("localhost","80")!=AF_INET6)
+        fail("the family that connected was not remembered");
+    if(dns_preferred_family("localhost","8080")!=AF_UNSPEC)
+        fail("the family was remembered for another port");
+
+    printf("dns test passed\n");
+    return 0;
+}
+
+
+/*
+	fake_getaddrinfo: the resolvers' stand-in for getaddrinfo, see
+	the comment at the top
+*/
+static int fake_getaddrinfo(const char* host, const char* port,
+	const struct addrinfo* hints, struct addrinfo** addrs) {
+    struct addrinfo numeric=*hints;
+
+    if(!strcmp(host,"localhost")) {
+        __atomic_fetch_add(&calls[LOCALHOST], 1, __ATOMIC_RELAXED);
+        return getaddrinfo(host,port,hints,addrs);
+    }
+    if(!strcmp(host,"slow.test")) {
+        __atomic_fetch_add(&calls[SLOW], 1, __ATOMIC_RELAXED);
+        usleep(SLOW_LOOKUP_MS*1000);
+        numeric.ai_flags=AI_NUMERICHOST|AI_NUMERICSERV;
+        return getaddrinfo("127.0.0.1",port,&numeric,addrs);
+    }
+    __atomic_fetch_add(&calls[OTHER], 1, __ATOMIC_RELAXED);
+    return EAI_NONAME;
+}
+
+/*
+	lookup_thread: look up slow.test, the answer goes to *vargp
+*/
+static void* lookup_thread(void* vargp) {
+    *(Dns_result_t**)vargp=dns_lookup("slow.test","80");
+    return NULL;
+}
+
+/*
+	resolved: the callback of dns_resolve, keeps the answer and wakes
+	up the test
+*/
+static void resolved(void* arg, Dns_result_t* result) {
+    callback_result=result;
+    V(&called_back);
+}
+
+/*
+	has_loopback: whether an answer holds 127.0.0.1 or ::1
+*/
+static bool has_loopback(Dns_result_t* result) {
+    struct addrinfo* p;
+
+    for(p=result->addrs;p;p=p->ai_next) {
+        if(p->ai_family==AF_INET&&((struct sockaddr_in*)p->ai_addr)
+            ->sin_addr.s_addr==htonl(INADDR_LOOPBACK))
+            return true;
+        if(p->ai_family==AF_INET6&&IN6_IS_ADDR_LOOPBACK(
+            &((struct sockaddr_in6*)p->ai_addr)->sin6_addr))
+            return true;
+    }
+    return false;
+}
+
+/*
+	fail: report what failed and exit
+*/
+static void fail(char* msg) {
+    fprintf(stderr,"dns test failed: %s\n",msg);
+    exit(1);
+}
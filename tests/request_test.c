@@ -0,0 +1,202 @@
+/************************************************************
+	request_test.c
+	The origin gets the client's header lines byte for byte
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+Starts ./proxy (with the options given) and an origin of its own that
+keeps the raw bytes of the request it is sent. A client asks the proxy
+for an object with a few header lines of its own, and the test checks
+what reached the origin:
+
+    every line ends with "\r\n", there is no bare '\r' or '\n';
+    the request line asks for the path, not the whole url;
+    the client's Host, Accept and X-Test lines are there unchanged;
+    the headers end with an empty line.
+
+usage: tests/request_test [proxy options]
+exits 0 when the test passes
+
+************************************************************/
+#include <stdbool.h>
+#include "csapp.h"
+
+#define OBJECT_SIZE 100
+#define TEST_TIMEOUT 5
+
+static pid_t proxy_pid;
+static char received[MAXBUF]; // the request the origin was sent
+static sem_t request_in; // posted once received is set
+
+static int listen_any(int* port);
+static void* origin_thread(void* vargp);
+static long proxy_request(int proxy_port, char* request);
+static void expect(char* line);
+static void fail(char* msg);
+
+
+int main(int argc, char** argv) {
+    char port_arg[16],request[MAXLINE],line[MAXLINE];
+    char* args[32];
+    char* p;
+    int proxy_port,origin_port,origin_fd,fd,i,n;
+    pthread_t tid;
+    struct timespec deadline;
+
+    Signal(SIGPIPE, SIG_IGN);
+    Sem_init(&request_in,0,0);
+    origin_fd=listen_any(&origin_port);
+    Pthread_create(&tid,NULL,origin_thread,&origin_fd);
+
+    fd=listen_any(&proxy_port);
+    Close(fd);
+    sprintf(port_arg,"%d",proxy_port);
+    args[0]="./proxy";
+    for(n=1,i=1;i<argc&&n<30;i++)
+        args[n++]=argv[i];
+    args[n++]=port_arg;
+    args[n]=NULL;
+    if((proxy_pid=Fork())==0) {
+        // the proxy's reports are not part of the test
+        fd=Open("/dev/null",O_WRONLY,0);
+        Dup2(fd,STDOUT_FILENO);
+        Execve(args[0],args,environ);
+    }
+    for(i=0;i<50;i++) { // wait for it to listen
+        usleep(100000);
+        if((fd=open_clientfd("127.0.0.1",port_arg))>=0) {
+            Close(fd);
+            break;
+        }
+    }
+
+    sprintf(request,"GET http://127.0.0.1:%d/headers HTTP/1.0\r\n"
+        "Host: 127.0.0.1:%d\r\nAccept: */*\r\nX-Test: one two\r\n\r\n",
+        origin_port,origin_port);
+    if(proxy_request(proxy_port,request)<OBJECT_SIZE)
+        fail("the client got no object");
+    clock_gettime(CLOCK_REALTIME,&deadline);
+    deadline.tv_sec+=TEST_TIMEOUT;
+    if(sem_timedwait(&request_in,&deadline)<0)
+        fail("the origin got no request");
+
+    if(!strstr(received,"\r\n\r\n"))
+        fail("the headers do not end with an empty line");
+    for(p=received;*p;p++) {
+        if((*p=='\r'&&p[1]!='\n')||
+            (*p=='\n'&&(p==received||p[-1]!='\r')))
+            fail("a line does not end with \\r\\n");
+    }
+    if(strncmp(received,"GET /headers HTTP/1.",20))
+        fail("the request line is not for the path");
+    sprintf(line,"Host: 127.0.0.1:%d",origin_port);
+    expect(line);
+    expect("Accept: */*");
+    expect("X-Test: one two");
+
+    kill(proxy_pid,SIGKILL);
+    waitpid(proxy_pid,NULL,0);
+    printf("request test passed\n");
+    return 0;
+}
+
+
+/*
+	listen_any: listen on a free port of 127.0.0.1, *port is set to it
+*/
+static int listen_any(int* port) {
+    struct sockaddr_in addr;
+    socklen_t len=sizeof(addr);
+    int fd=Socket(AF_INET,SOCK_STREAM,0);
+
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family=AF_INET;
+    addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+    Bind(fd,(SA*)&addr,sizeof(addr));
+    Listen(fd,LISTENQ);
+    getsockname(fd,(SA*)&addr,&len);
+    *port=ntohs(addr.sin_port);
+    return fd;
+}
+
+/*
+	origin_thread: keep the bytes of the first request, up to the end
+	of its headers, in received; answer every request with an object
+	of OBJECT_SIZE bytes and close the connection
+*/
+static void* origin_thread(void* vargp) {
+    static char body[OBJECT_SIZE];
+    char buf[MAXBUF];
+    int listenfd=*(int*)vargp,fd;
+    bool first=true;
+    size_t len;
+    ssize_t n;
+
+    memset(body,'x',sizeof(body));
+    while(1) {
+        fd=Accept(listenfd,NULL,NULL);
+        buf[len=0]='\0';
+        while(!strstr(buf,"\r\n\r\n")&&len<sizeof(buf)-1&&
+            (n=read(fd,buf+len,sizeof(buf)-1-len))>0) {
+            len+=n;
+            buf[len]='\0';
+        }
+        if(first) {
+            strcpy(received,buf);
+            first=false;
+            V(&request_in);
+        }
+        sprintf(buf,"HTTP/1.0 200 OK\r\nContent-Length: %d\r\n\r\n",
+            OBJECT_SIZE);
+        if(rio_writen(fd,buf,strlen(buf))>=0)
+            rio_writen(fd,body,OBJECT_SIZE);
+        Close(fd);
+    }
+    return NULL;
+}
+
+/*
+	proxy_request: send request to the proxy and read the answer
+	until the proxy closes the connection
+	return the bytes read, -1 when it timed out
+*/
+static long proxy_request(int proxy_port, char* request) {
+    struct timeval timeout={TEST_TIMEOUT,0};
+    char buf[MAXBUF],port[16];
+    long total=0,n;
+    int fd;
+
+    sprintf(port,"%d",proxy_port);
+    if((fd=open_clientfd("127.0.0.1",port))<0)
+        fail("connect to the proxy");
+    setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+    if(rio_writen(fd,request,strlen(request))<0)
+        fail("write to the proxy");
+    while((n=read(fd,buf,sizeof(buf)))>0)
+        total+=n;
+    Close(fd);
+    return n<0? -1 : total;
+}
+
+/*
+	expect: the origin was sent line, whole, as a header line
+*/
+static void expect(char* line) {
+    char want[MAXLINE],msg[MAXLINE*2];
+
+    sprintf(want,"\r\n%s\r\n",line);
+    if(!strstr(received,want)) {
+        sprintf(msg,"the origin did not get \"%s\"",line);
+        fail(msg);
+    }
+}
+
+/*
+	fail: report what failed and exit, the proxy goes with the test
+*/
+static void fail(char* msg) {
+    fprintf(stderr,"request test failed: %s\n",msg);
+    if(proxy_pid>0)
+        kill(proxy_pid,SIGKILL);
+    exit(1);
+}
@@ -0,0 +1,256 @@
+/************************************************************
+	slow_client_test.c
+	A client that stops reading does not hold up the cache
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+Starts ./proxy with one cache shard (plus the options given) and an
+origin of its own, fills the cache with 90 KB objects and caches one
+more, then opens a client with a tiny receive buffer and segment size
+that asks for that object and reads nothing, so the proxy's write to
+it stalls. While it is stalled, another client misses a new url,
+whose insert into the same shard has to evict, a third one has to hit
+that url, and a fourth one reads the stalled object too. Each of them
+must finish within TEST_TIMEOUT seconds; once they have, the stalled
+client reads its response, which must be intact.
+
+usage: tests/slow_client_test [proxy options]
+exits 0 when the test passes
+
+************************************************************/
+#include <stdbool.h>
+#include <netinet/tcp.h>
+#include "csapp.h"
+
+#define BIG_SIZE 90000
+#define FILL_OBJECTS 12 // more than MAX_CACHE_SIZE holds
+#define TEST_TIMEOUT 5
+#define SLOW_MSS 536
+
+static int origin_port;
+static int origin_hits[2]; // /big and /new
+static pid_t proxy_pid;
+
+static int listen_any(int* port);
+static void* origin_thread(void* vargp);
+static void* origin_conn_thread(void* vargp);
+static int proxy_request(int proxy_port, char* path, int rcvbuf);
+static long read_response(int fd);
+static void fail(char* msg);
+
+
+int main(int argc, char** argv) {
+    char port_arg[16];
+    char* args[32];
+    char path[MAXLINE];
+    int proxy_port,origin_fd,fd,slow,i,n;
+    pthread_t tid;
+
+    Signal(SIGPIPE, SIG_IGN);
+    origin_fd=listen_any(&origin_port);
+    Pthread_create(&tid,NULL,origin_thread,&origin_fd);
+
+    // a free port for the proxy
+    fd=listen_any(&proxy_port);
+    Close(fd);
+    sprintf(port_arg,"%d",proxy_port);
+    args[0]="./proxy";
+    args[1]="-s";
+    args[2]="1";
+    for(n=3,i=1;i<argc&&n<30;i++)
+        args[n++]=argv[i];
+    args[n++]=port_arg;
+    args[n]=NULL;
+    if((proxy_pid=Fork())==0) {
+        int null=Open("/dev/null",O_WRONLY,0);
+        Dup2(null,STDOUT_FILENO);
+        Execve(args[0],args,environ);
+    }
+    for(i=0;i<50;i++) { // wait for it to listen
+        usleep(100000);
+        if((fd=open_clientfd("127.0.0.1",port_arg))>=0) {
+            Close(fd);
+            break;
+        }
+    }
+
+    for(i=0;i<FILL_OBJECTS;i++) {
+        sprintf(path,"/fill/%d",i);
+        fd=proxy_request(proxy_port,path,0);
+        if(read_response(fd)!=BIG_SIZE)
+            fail("filling the cache");
+        Close(fd);
+    }
+    fd=proxy_request(proxy_port,"/big",0);
+    if(read_response(fd)!=BIG_SIZE)
+        fail("first fetch of /big");
+    Close(fd);
+
+    slow=proxy_request(proxy_port,"/big",1024);
+    sleep(1); // the proxy fills the socket buffers and stalls
+
+    fd=proxy_request(proxy_port,"/new",0);
+    if(read_response(fd)!=BIG_SIZE)
+        fail("miss on /new while a client is stalled");
+    Close(fd);
+    fd=proxy_request(proxy_port,"/new",0);
+    if(read_response(fd)!=BIG_SIZE)
+        fail("hit on /new while a client is stalled");
+    Close(fd);
+    if(origin_hits[1]!=1)
+        fail("/new was not inserted while a client is stalled");
+    fd=proxy_request(proxy_port,"/big",0);
+    if(read_response(fd)!=BIG_SIZE)
+        fail("second reader of /big while a client is stalled");
+    Close(fd);
+    if(origin_hits[0]!=1)
+        fail("/big was fetched again");
+
+    if(read_response(slow)!=BIG_SIZE)
+        fail("the stalled client's response");
+    Close(slow);
+
+    kill(proxy_pid,SIGKILL);
+    waitpid(proxy_pid,NULL,0);
+    printf("slow client test passed\n");
+    return 0;
+}
+
+/*
+	listen_any: listen on a free port of 127.0.0.1, *port is set to it
+*/
+static int listen_any(int* port) {
+    struct sockaddr_in addr;
+    socklen_t len=sizeof(addr);
+    int fd=Socket(AF_INET,SOCK_STREAM,0);
+
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family=AF_INET;
+    addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+    Bind(fd,(SA*)&addr,sizeof(addr));
+    Listen(fd,LISTENQ);
+    getsockname(fd,(SA*)&addr,&len);
+    *port=ntohs(addr.sin_port);
+    return fd;
+}
+
+/*
+	origin_thread: accept the proxy's connections to the origin
+*/
+static void* origin_thread(void* vargp) {
+    int listenfd=*(int*)vargp;
+    long fd;
+    pthread_t tid;
+
+    while(1) {
+        fd=Accept(listenfd,NULL,NULL);
+        Pthread_create(&tid,NULL,origin_conn_thread,(void*)fd);
+    }
+    return NULL;
+}
+
+/*
+	origin_conn_thread: answer every request on one persistent
+	connection with BIG_SIZE bytes, counting those for /big and /new
+*/
+static void* origin_conn_thread(void* vargp) {
+    static char body[BIG_SIZE];
+    char buf[MAXLINE],head[MAXLINE];
+    int fd=(long)vargp;
+    bool close_after;
+    rio_t rio;
+
+    Pthread_detach(pthread_self());
+    memset(body,'x',sizeof(body));
+    Rio_readinitb(&rio,fd);
+    while(rio_readlineb(&rio,buf,MAXLINE)>0) {
+        if(strstr(buf,"/big "))
+            __atomic_fetch_add(&origin_hits[0],1,__ATOMIC_SEQ_CST);
+        else if(strstr(buf,"/new "))
+            __atomic_fetch_add(&origin_hits[1],1,__ATOMIC_SEQ_CST);
+        close_after=false;
+        while(rio_readlineb(&rio,head,MAXLINE)>0&&strcmp(head,"\r\n"))
+            if(!strcasecmp(head,"Connection: close\r\n"))
+                close_after=true;
+        sprintf(head,"HTTP/1.1 200 OK\r\nContent-Length: %d\r\n"
+            "Cache-Control: max-age=300\r\n\r\n",BIG_SIZE);
+        if(rio_writen(fd,head,strlen(head))<0||
+            rio_writen(fd,body,BIG_SIZE)<0)
+            break;
+        if(close_after)
+            break;
+    }
+    Close(fd);
+    return NULL;
+}
+
+/*
+	proxy_request: ask the proxy for path on the origin, with a
+	receive buffer of rcvbuf bytes unless it is 0; the answer times
+	out after TEST_TIMEOUT seconds
+	return the connection
+*/
+static int proxy_request(int proxy_port, char* path, int rcvbuf) {
+    struct sockaddr_in addr;
+    struct timeval timeout={TEST_TIMEOUT,0};
+    char request[MAXLINE];
+    int fd=Socket(AF_INET,SOCK_STREAM,0);
+    int mss=SLOW_MSS;
+
+    if(rcvbuf) {
+        setsockopt(fd,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf));
+        setsockopt(fd,IPPROTO_TCP,TCP_MAXSEG,&mss,sizeof(mss));
+    }
+    setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family=AF_INET;
+    addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+    addr.sin_port=htons(proxy_port);
+    if(connect(fd,(SA*)&addr,sizeof(addr))<0)
+        fail("connect to the proxy");
+    sprintf(request,"GET http://127.0.0.1:%d%s HTTP/1.0\r\n"
+        "Host: 127.0.0.1\r\n\r\n",origin_port,path);
+    if(rio_writen(fd,request,strlen(request))<0)
+        fail("write to the proxy");
+    return fd;
+}
+
+/*
+	read_response: read a response to its end
+	return the size of its body, -1 when it timed out or is broken
+*/
+static long read_response(int fd) {
+    char buf[MAXBUF];
+    char* body;
+    long total=0,n;
+    char* all=Malloc(BIG_SIZE+MAXBUF);
+
+    while((n=read(fd,buf,sizeof(buf)))>0) {
+        if(total+n>BIG_SIZE+MAXBUF-1)
+            break;
+        memcpy(all+total,buf,n);
+        total+=n;
+    }
+    all[total]='\0';
+    if(n<0||(body=strstr(all,"\r\n\r\n"))==NULL) {
+        Free(all);
+        return -1;
+    }
+    body+=4;
+    n=total-(body-all);
+    for(total=0;total<n;total++)
+        if(body[total]!='x')
+            break;
+    Free(all);
+    return total==n? n : -1;
+}
+
+/*
+	fail: report what failed and exit, the proxy goes with the test
+*/
+static void fail(char* msg) {
+    fprintf(stderr,"slow client test failed: %s\n",msg);
+    if(proxy_pid>0)
+        kill(proxy_pid,SIGKILL);
+    exit(1);
+}
@@ -0,0 +1,244 @@
+/************************************************************
+	writev_test.c
+	Requests, cache hits and error pages each go out in one writev
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+Starts ./proxy (with the options given) writing its stdout to a
+temporary file and an origin of its own, then reads the proxy's
+outvec counters (see outvec.c) by sending it SIGUSR1 before and after
+each of these, and checks how much they moved:
+
+    a miss: one writev, the rewritten request to the origin;
+    a hit: one writev of one segment, the cached response, as many
+    bytes as the client got;
+    a request the proxy does not implement: one writev, the error
+    page, as many bytes as the client got.
+
+The event loops (-e, -r) write hits and partial requests with plain
+writes as the sockets allow, so this test is for the threaded
+servers.
+
+usage: tests/writev_test [proxy options]
+exits 0 when the test passes
+
+************************************************************/
+#include <stdbool.h>
+#include "csapp.h"
+
+#define OBJECT_SIZE 5000
+#define TEST_TIMEOUT 5
+
+/* the outvec counters of the proxy */
+struct outvec_counts {
+    long writes;
+    long segments;
+    long bytes;
+};
+
+static int origin_port;
+static pid_t proxy_pid;
+static char stdout_path[]="/tmp/writev_testXXXXXX";
+
+static int listen_any(int* port);
+static void* origin_thread(void* vargp);
+static long proxy_request(int proxy_port, char* request);
+static void read_counts(struct outvec_counts* counts);
+static void check(struct outvec_counts* before, long writes,
+	long segments, long bytes, char* what);
+static void fail(char* msg);
+
+
+int main(int argc, char** argv) {
+    char port_arg[16],request[MAXLINE];
+    char* args[32];
+    int proxy_port,origin_fd,fd,out,i,n;
+    long got;
+    pthread_t tid;
+    struct outvec_counts counts;
+
+    Signal(SIGPIPE, SIG_IGN);
+    origin_fd=listen_any(&origin_port);
+    Pthread_create(&tid,NULL,origin_thread,&origin_fd);
+
+    fd=listen_any(&proxy_port);
+    Close(fd);
+    sprintf(port_arg,"%d",proxy_port);
+    out=mkstemp(stdout_path);
+    args[0]="./proxy";
+    for(n=1,i=1;i<argc&&n<30;i++)
+        args[n++]=argv[i];
+    args[n++]=port_arg;
+    args[n]=NULL;
+    if((proxy_pid=Fork())==0) {
+        Dup2(out,STDOUT_FILENO);
+        Execve(args[0],args,environ);
+    }
+    Close(out);
+    for(i=0;i<50;i++) { // wait for it to listen
+        usleep(100000);
+        if((fd=open_clientfd("127.0.0.1",port_arg))>=0) {
+            Close(fd);
+            break;
+        }
+    }
+
+    sprintf(request,"GET http://127.0.0.1:%d/object HTTP/1.0\r\n\r\n",
+        origin_port);
+    read_counts(&counts);
+    if(proxy_request(proxy_port,request)<OBJECT_SIZE)
+        fail("the miss got no object");
+    check(&counts,1,-1,-1,"miss");
+
+    read_counts(&counts);
+    if((got=proxy_request(proxy_port,request))<OBJECT_SIZE)
+        fail("the hit got no object");
+    check(&counts,1,1,got,"hit");
+
+    sprintf(request,"BREW http://127.0.0.1:%d/object HTTP/1.0\r\n\r\n",
+        origin_port);
+    read_counts(&counts);
+    if((got=proxy_request(proxy_port,request))<=0)
+        fail("no error page");
+    check(&counts,1,-1,got,"error page");
+
+    kill(proxy_pid,SIGKILL);
+    waitpid(proxy_pid,NULL,0);
+    unlink(stdout_path);
+    printf("writev test passed\n");
+    return 0;
+}
+
+
+/*
+	listen_any: listen on a free port of 127.0.0.1, *port is set to it
+*/
+static int listen_any(int* port) {
+    struct sockaddr_in addr;
+    socklen_t len=sizeof(addr);
+    int fd=Socket(AF_INET,SOCK_STREAM,0);
+
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family=AF_INET;
+    addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+    Bind(fd,(SA*)&addr,sizeof(addr));
+    Listen(fd,LISTENQ);
+    getsockname(fd,(SA*)&addr,&len);
+    *port=ntohs(addr.sin_port);
+    return fd;
+}
+
+/*
+	origin_thread: answer every request with a cacheable object of
+	OBJECT_SIZE bytes and close the connection
+*/
+static void* origin_thread(void* vargp) {
+    static char body[OBJECT_SIZE];
+    char buf[MAXLINE];
+    int listenfd=*(int*)vargp,fd;
+    rio_t rio;
+
+    memset(body,'x',sizeof(body));
+    while(1) {
+        fd=Accept(listenfd,NULL,NULL);
+        Rio_readinitb(&rio,fd);
+        while(rio_readlineb(&rio,buf,MAXLINE)>0&&strcmp(buf,"\r\n"))
+            ;
+        sprintf(buf,"HTTP/1.0 200 OK\r\nContent-Length: %d\r\n"
+            "Cache-Control: max-age=300\r\n\r\n",OBJECT_SIZE);
+        if(rio_writen(fd,buf,strlen(buf))>=0)
+            rio_writen(fd,body,OBJECT_SIZE);
+        Close(fd);
+    }
+    return NULL;
+}
+
+/*
+	proxy_request: send request to the proxy and read the answer
+	until the proxy closes the connection
+	return the bytes read, -1 when it timed out
+*/
+static long proxy_request(int proxy_port, char* request) {
+    struct timeval timeout={TEST_TIMEOUT,0};
+    char buf[MAXBUF],port[16];
+    long total=0,n;
+    int fd;
+
+    sprintf(port,"%d",proxy_port);
+    if((fd=open_clientfd("127.0.0.1",port))<0)
+        fail("connect to the proxy");
+    setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+    if(rio_writen(fd,request,strlen(request))<0)
+        fail("write to the proxy");
+    while((n=read(fd,buf,sizeof(buf)))>0)
+        total+=n;
+    Close(fd);
+    return n<0? -1 : total;
+}
+
+/*
+	read_counts: make the proxy print its counters and read the
+	outvec ones from its stdout
+*/
+static void read_counts(struct outvec_counts* counts) {
+    static int seen; // counter lines read so far
+    char buf[MAXBUF*8];
+    char *p,*line;
+    int i,fd,lines;
+    long n;
+
+    kill(proxy_pid,SIGUSR1);
+    for(i=0;i<TEST_TIMEOUT*100;i++) {
+        usleep(10000);
+        fd=Open(stdout_path,O_RDONLY,0);
+        n=Read(fd,buf,sizeof(buf)-1);
+        Close(fd);
+        buf[n]='\0';
+        // the last complete counter line, and how many there are
+        for(lines=0,line=NULL,p=buf;(p=strstr(p,"outvec: "));p++) {
+            if(!strchr(p,'\n'))
+                break;
+            line=p;
+            lines++;
+        }
+        if(lines>seen&&sscanf(line,"outvec: writev=%ld segments=%ld"
+            " bytes=%ld",&counts->writes,&counts->segments,
+            &counts->bytes)==3) {
+            seen=lines;
+            return;
+        }
+    }
+    fail("the proxy printed no counters");
+}
+
+/*
+	check: the counters moved by writes writev calls, segments
+	segments and bytes bytes since before (-1: any number)
+*/
+static void check(struct outvec_counts* before, long writes,
+	long segments, long bytes, char* what) {
+    struct outvec_counts after;
+    char msg[MAXLINE];
+
+    read_counts(&after);
+    if(after.writes-before->writes!=writes||
+        (segments>=0&&after.segments-before->segments!=segments)||
+        (bytes>=0&&after.bytes-before->bytes!=bytes)) {
+        sprintf(msg,"%s took %ld writev, %ld segments, %ld bytes",what,
+            after.writes-before->writes,
+            after.segments-before->segments,
+            after.bytes-before->bytes);
+        fail(msg);
+    }
+}
+
+/*
+	fail: report what failed and exit, the proxy goes with the test
+*/
+static void fail(char* msg) {
+    fprintf(stderr,"writev test failed: %s\n",msg);
+    if(proxy_pid>0)
+        kill(proxy_pid,SIGKILL);
+    unlink(stdout_path);
+    exit(1);
+}
@@ -0,0 +1,168 @@
+/************************************************************
+	upstream.c
+	A pool of idle persistent connections to servers
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+After a response that leaves the connection open (HTTP/1.1 with a
+Content-Length or chunked body), the connection to the server is put
+back in the pool of its host and port instead of being closed, and
+the next miss for the same server takes it instead of doing a new
+getaddrinfo and TCP handshake.
+
+A connection is kept at most UPSTREAM_IDLE_TIMEOUT seconds and at
+most MAX_IDLE_PER_HOST are kept per server. Before one is reused it
+is checked that the server has not closed it meanwhile.
+
+************************************************************/
+#include <time.h>
+#include "proxy.h"
+#include "upstream.h"
+
+/*
+	An idle connection and when it was put back
+*/
+struct idle_conn {
+    int fd;
+    time_t last_used;
+};
+
+/*
+	The idle connections of one host and port, newest last
+*/
+struct upstream_host {
+    char* key; // "host:port"
+    unsigned long hash;
+    struct idle_conn idle[MAX_IDLE_PER_HOST];
+    int nidle;
+    struct upstream_host* next; // next host in the same bucket
+};
+
+static struct upstream_host* hosts[UPSTREAM_BUCKETS];
+static sem_t pool_lock; // protects hosts and their idle connections
+
+static struct upstream_host* find_host(char* key, bool create);
+static void close_expired(struct upstream_host* h, time_t now);
+static bool still_open(int fd);
+
+
+/*
+	init_upstream_pool: set up an empty pool
+*/
+void init_upstream_pool(void) {
+    Sem_init(&pool_lock, 0, 1);
+}
+
+/*
+	upstream_connect: get a connection to host and port, an idle one
+	from the pool when there is one that is still open, otherwise a
+	new one; reused tells which.
+	return -1 when cannot connect to server
+*/
+int upstream_connect(char* host, char* port, bool* reused) {
+    char key[MAXLINE*2];
+    struct upstream_host* h;
+    int fd;
+
+    snprintf(key,sizeof(key),"%s:%s",host,port);
+    while(1) {
+        fd=-1;
+        P(&pool_lock);
+        h=find_host(key,false);
+        if(h) {
+            close_expired(h,time(NULL));
+            if(h->nidle>0)
+                fd=h->idle[--h->nidle].fd;
+        }
+        V(&pool_lock);
+
+        if(fd<0)
+            break;
+        if(still_open(fd)) {
+            *reused=true;
+            return fd;
+        }
+        close(fd);
+    }
+
+    *reused=false;
+    return modified_open_clientfd(host,port);
+}
+
+/*
+	upstream_release: put a connection that finished a response and
+	stays open back in the pool of its host and port; it is closed
+	when the pool is full
+*/
+void upstream_release(char* host, char* port, int fd) {
+    char key[MAXLINE*2];
+    struct upstream_host* h;
+    time_t now=time(NULL);
+
+    snprintf(key,sizeof(key),"%s:%s",host,port);
+    P(&pool_lock);
+    h=find_host(key,true);
+    close_expired(h,now);
+    if(h->nidle<MAX_IDLE_PER_HOST) {
+        h->idle[h->nidle].fd=fd;
+        h->idle[h->nidle].last_used=now;
+        h->nidle++;
+        fd=-1;
+    }
+    V(&pool_lock);
+    if(fd>=0)
+        close(fd);
+}
+
+
+/*
+	find_host: find the pool of a "host:port" key, create an empty
+	one when asked to. Called with pool_lock held.
+*/
+static struct upstream_host* find_host(char* key, bool create) {
+    unsigned long hash=cache_hash(key);
+    struct upstream_host* h=hosts[hash%UPSTREAM_BUCKETS];
+
+    while(h) {
+        if(h->hash==hash&&!strcmp(h->key,key))
+            return h;
+        h=h->next;
+    }
+    if(!create)
+        return NULL;
+    h=Calloc(1,sizeof(struct upstream_host));
+    h->key=Malloc(strlen(key)+1);
+    strcpy(h->key,key);
+    h->hash=hash;
+    h->next=hosts[hash%UPSTREAM_BUCKETS];
+    hosts[hash%UPSTREAM_BUCKETS]=h;
+    return h;
+}
+
+/*
+	close_expired: close the connections of a host that have been idle
+	too long; they are the oldest, at the front. Called with
+	pool_lock held.
+*/
+static void close_expired(struct upstream_host* h, time_t now) {
+    int i,n=0;
+
+    while(n<h->nidle&&now-h->idle[n].last_used>UPSTREAM_IDLE_TIMEOUT)
+        close(h->idle[n++].fd);
+    if(n==0)
+        return;
+    for(i=n;i<h->nidle;i++)
+        h->idle[i-n]=h->idle[i];
+    h->nidle-=n;
+}
+
+/*
+	still_open: an idle connection is usable when there is nothing to
+	read on it; end of file means the server closed it, and data means
+	the server sent something we cannot match to a request
+*/
+static bool still_open(int fd) {
+    char c;
+    ssize_t n=recv(fd,&c,1,MSG_PEEK|MSG_DONTWAIT);
+    return n<0&&(errno==EAGAIN||errno==EWOULDBLOCK);
+}
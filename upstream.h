@@ -0,0 +1,25 @@
+/************************************************************
+	upstream.h
+	A pool of idle persistent connections to servers
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __UPSTREAM_H__
+#define __UPSTREAM_H__
+
+#include <stdbool.h>
+
+/* idle connections kept for one host and port */
+#define MAX_IDLE_PER_HOST 8
+/* seconds an idle connection is kept before it is closed */
+#define UPSTREAM_IDLE_TIMEOUT 30
+/* buckets of the host table */
+#define UPSTREAM_BUCKETS 256
+
+void init_upstream_pool(void);
+int upstream_connect(char* host, char* port, bool* reused);
+void upstream_release(char* host, char* port, int fd);
+
+#endif /* __UPSTREAM_H__ */
@@ -0,0 +1,203 @@
+/************************************************************
+	zerocopy.c
+	Move a response body between sockets without copying it
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+A body is moved from the server's socket into a pipe and from the
+pipe into the client's socket with splice, so its pages never go
+through user space. While the response may still be cached, the
+bytes in the pipe are also duplicated with tee into a second pipe and
+read from there into the cache's copy. The reads stop where the copy
+is full, so the caller can grow it as the bytes arrive; once it is too
+big for the cache only the splices are left. A response kept by the disk tier is
+teed the same way, but the copy is spliced into its file, so it does
+not go through user space either.
+
+Each thread keeps its two pipes, they are closed when it ends.
+splice and tee need _GNU_SOURCE, which conflicts with csapp.h (see
+affinity.c), so this file does not include it.
+
+************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "zerocopy.h"
+
+/*
+	The pipes of one thread: body goes to the client, copy to the cache
+*/
+struct relay_pipes {
+    int body[2];
+    int copy[2];
+};
+
+static pthread_key_t pipes_key;
+static pthread_once_t pipes_once=PTHREAD_ONCE_INIT;
+
+static struct relay_pipes* thread_pipes(void);
+static void close_pipes(void* vargp);
+static void make_key(void);
+
+
+/*
+	splice_body: move len bytes (len<0: up to end of file) from the
+	socket from to the socket to. While copy is not NULL the bytes
+	are also put there, copy_max bytes at most: the reads are cut to
+	what still fits, and once copy is full the move stops so that the
+	caller can give it more room (or pass NULL from then on). While
+	file is not -1 the bytes are also written to it, a write error
+	only stops that. moved is set to the number of bytes written to
+	to, filed to the number written to file.
+	return 1 when copy is full before the body ends
+	return 0 when success
+	return -1 when read error, or end of file before len bytes
+	return -2 when write error
+*/
+int splice_body(int from, int to, long len, char* copy, long copy_max,
+	int file, long* moved, long* filed) {
+    struct relay_pipes* p=thread_pipes();
+    long copied=0;
+    ssize_t n,m,out;
+    size_t want;
+    int rc=0;
+    bool dirty=false; // bytes were left in the copy pipe
+
+    *moved=0;
+    *filed=0;
+    if(p==NULL)
+        return -1;
+    while(len!=0) {
+        want=len>0&&len<SPLICE_CHUNK? (size_t)len : SPLICE_CHUNK;
+        if(copy&&copied==copy_max) {
+            rc=1;
+            break;
+        }
+        if(copy&&(long)want>copy_max-copied)
+            want=copy_max-copied;
+        n=splice(from,NULL,p->body[1],NULL,want,SPLICE_F_MOVE|SPLICE_F_MORE);
+        if(n<0&&errno==EINTR)
+            continue;
+        if(n<0||(n==0&&len>0)) {
+            rc=-1;
+            break;
+        }
+        if(n==0)
+            break; // end of file ends the body
+
+        if(copy) {
+            // the pipe is empty, so tee takes all n bytes at once
+            m=tee(p->body[0],p->copy[1],n,0);
+            while(m>0) {
+                ssize_t k=read(p->copy[0],copy+copied,m);
+                if(k<0&&errno==EINTR)
+                    continue;
+                if(k<=0)
+                    break;
+                copied+=k;
+                m-=k;
+            }
+            if(m!=0) {
+                rc=-1;
+                break;
+            }
+        }
+
+        if(file>=0) {
+            m=tee(p->body[0],p->copy[1],n,0);
+            while(m>0) {
+                ssize_t k=splice(p->copy[0],NULL,file,NULL,m,SPLICE_F_MOVE);
+                if(k<0&&errno==EINTR)
+                    continue;
+                if(k<=0)
+                    break;
+                *filed+=k;
+                m-=k;
+            }
+            if(m!=0) {
+                // the file is given up, the client is still served
+                dirty=dirty||m>0;
+                file=-1;
+            }
+        }
+
+        for(out=0;out<n;) {
+            m=splice(p->body[0],NULL,to,NULL,n-out,SPLICE_F_MOVE|SPLICE_F_MORE);
+            if(m<0&&errno==EINTR)
+                continue;
+            if(m<=0) {
+                rc=-2;
+                break;
+            }
+            out+=m;
+            *moved+=m;
+        }
+        if(rc<0)
+            break;
+        if(len>0)
+            len-=n;
+    }
+
+    if(rc<0||dirty) {
+        // bytes may be left in the pipes, start over with new ones
+        close_pipes(p);
+        pthread_setspecific(pipes_key,NULL);
+    }
+    return rc;
+}
+
+
+/*
+	thread_pipes: the pipes of the calling thread, made the first
+	time it needs them
+	return NULL on error
+*/
+static struct relay_pipes* thread_pipes(void) {
+    struct relay_pipes* p;
+
+    pthread_once(&pipes_once,make_key);
+    if((p=pthread_getspecific(pipes_key))!=NULL)
+        return p;
+    if((p=malloc(sizeof(struct relay_pipes)))==NULL)
+        return NULL;
+    if(pipe(p->body)<0) {
+        free(p);
+        return NULL;
+    }
+    if(pipe(p->copy)<0) {
+        close(p->body[0]);
+        close(p->body[1]);
+        free(p);
+        return NULL;
+    }
+    // one chunk must fit in the pipe
+    fcntl(p->body[1],F_SETPIPE_SZ,SPLICE_CHUNK);
+    fcntl(p->copy[1],F_SETPIPE_SZ,SPLICE_CHUNK);
+    pthread_setspecific(pipes_key,p);
+    return p;
+}
+
+/*
+	close_pipes: close the pipes of a thread, also the destructor
+	run when the thread ends
+*/
+static void close_pipes(void* vargp) {
+    struct relay_pipes* p=vargp;
+
+    close(p->body[0]);
+    close(p->body[1]);
+    close(p->copy[0]);
+    close(p->copy[1]);
+    free(p);
+}
+
+/*
+	make_key: make the key of the thread's pipes, once
+*/
+static void make_key(void) {
+    pthread_key_create(&pipes_key,close_pipes);
+}
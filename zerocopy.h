@@ -0,0 +1,18 @@
+/************************************************************
+	zerocopy.h
+	Move a response body between sockets without copying it
+	Name: Kaimin Huang
+	Andrew ID: kaiminh1
+
+************************************************************/
+
+#ifndef __ZEROCOPY_H__
+#define __ZEROCOPY_H__
+
+/* most bytes moved through the pipe at a time */
+#define SPLICE_CHUNK 65536
+
+int splice_body(int from, int to, long len, char* copy, long copy_max,
+	int file, long* moved, long* filed);
+
+#endif /* __ZEROCOPY_H__ */